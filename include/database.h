@@ -7,7 +7,20 @@
  *
  * @copyright Copyright (c) 2022
  *
- * @note 用户信息使用txt文件存储，快递信息使用sqlite数据库存储。
+ * @note 用户信息和快递信息都使用sqlite数据库存储，user表以用户名为主键。
+ * @note 旧版的用户txt快照及其日志会在首次启动时自动导入user表。
+ * @note user表的读取靠SQLite自己的内存映射I/O(mmap_size)和页缓存，不另设用户存储，崩溃恢复完全交给WAL。
+ * @note 余额的每次变动都记入只追加的ledger表，一次转账只追加一条记录；用户余额是账本的物化视图，与账本记录在同一个事务中更新。
+ * @note item表的寄送时间和接收时间各存为一个可排序的日序号列，旧版按年、月、日分列存储的item表在启动时自动迁移。
+ * @note 签收已久的物品由后台归档到结构相同的item_archive表，查询条件可能匹配归档物品时才读归档表并与item表的结果归并。
+ * @note 物品描述用item_gram表做倒排索引，每个字符和每两个相邻字符各是一个词项，随插入、删除物品同步维护。
+ * @note 数据库使用WAL日志，写连接只有一个；查询物品时，非主线程使用各自的只读连接，与写入并行。
+ * @note 常用的SQL语句只预编译一次，之后每次只重新绑定参数；物品查询按条件组合(位掩码)缓存。
+ * @note 支持组提交：beginGroupCommit与commitGroupCommit之间的所有写入共用一个事务，只在提交时落盘一次。
+ * @note 组内每个请求包在beginRequest/endRequest的保存点中，一个请求的写入失败只撤销这个请求。
+ * @note 组提交中插入的物品先攒在内存中，请求结束前或写连接上读写item表前用一次execBatch批量插入。
+ * @note 物品和用户可以用CSV文件批量导入、导出，导入时每BULK_BATCH_SIZE行用一次组提交写入。
+ * @note 可选在内存中维护item表的列式副本(见itemstore.h)，工作线程上按单号排序的物品查询直接扫描副本。
  * @note 对于用户部分, 定义了插入用户(注册), 查询用户, 修改用户密码, 修改用户余额的接口.
  * @note 对于物品部分, 定义了插入物品, 查询物品(根据发送人/接收人/时间/快递单号即id), 修改物品信息, 删除物品的接口.
  */
@@ -16,23 +29,71 @@
 #define DATABASE_H
 
 #include <QFile>
+#include <QThreadStorage>
 #include <QtSql>
 
 #include "item.h"
+#include "itemstore.h"
 #include "user.h"
 
 class Item;
 class Time;
 class User;
 
+const QString DATABASE_FILE_NAME("../data/db.sqlite"); // SQLite数据库文件
+const QString SETTINGS_FILE_NAME("../data/server.ini"); //配置文件
+const QString DATA_DIR_NAME("../data");                 //默认的数据目录，导入导出的CSV文件只能放在其中
+const int BULK_BATCH_SIZE = 50000;                       //批量导入时每个事务插入的行数
+const int BULK_ID_CHUNK = 500;                           //IN列表中每条语句绑定的单号数，不超过SQLite的参数个数上限
+
+/**
+ * @brief 逐个接收用户查询结果的回调
+ */
+typedef std::function<void(const QSharedPointer<User> &)> UserSink;
+
+/**
+ * @brief 物品查询条件的位掩码，每种条件组合对应一条预编译的SQL语句
+ */
+enum ItemFilter
+{
+    ITEM_FILTER_ID = 1 << 0,
+    ITEM_FILTER_STATE = 1 << 1,
+    ITEM_FILTER_SENDING_YEAR = 1 << 2,
+    ITEM_FILTER_SENDING_MONTH = 1 << 3,
+    ITEM_FILTER_SENDING_DAY = 1 << 4,
+    ITEM_FILTER_RECEIVING_YEAR = 1 << 5,
+    ITEM_FILTER_RECEIVING_MONTH = 1 << 6,
+    ITEM_FILTER_RECEIVING_DAY = 1 << 7,
+    ITEM_FILTER_SRC_NAME = 1 << 8,
+    ITEM_FILTER_DST_NAME = 1 << 9,
+    ITEM_FILTER_EXPRESSMAN = 1 << 10,
+    ITEM_FILTER_SENDING_FROM = 1 << 11,
+    ITEM_FILTER_SENDING_TO = 1 << 12,
+    ITEM_FILTER_AFTER = 1 << 13,           //从上一页最后一条之后开始
+    ITEM_FILTER_LIMIT = 1 << 14,           //限制返回的条数
+    ITEM_FILTER_ORDER_SENDING_TIME = 1 << 15, //按寄送时间排序，否则按单号
+    ITEM_FILTER_ARCHIVE = 1 << 16,            //查询归档表item_archive，否则查询item表
+    ITEM_FILTER_DESCRIPTION = 1 << 17         //描述中包含某段文字
+};
+
+/**
+ * @brief 账本记录
+ */
+struct LedgerEntry
+{
+    int id;          //流水号
+    QString srcName; //付款用户的用户名，为空表示充值
+    QString dstName; //收款用户的用户名，为空表示提现
+    int amount;      //金额
+    Time time;       //物流系统时间
+};
+
 /**
  * @brief 数据库类
  */
 class Database
 {
 public:
-    QSet<QString> usernameSet; //用户名集合
-
     /**
      * @brief 删除默认构造函数
      */
@@ -41,12 +102,105 @@ public:
     /**
      * @brief 构造函数
      * @param connectionName 连接名称
-     * @param fileName 文件名
+     * @param fileName 旧版用户信息文件名
+     * @param columnarItems 是否在内存中维护item表的列式副本
      *
-     * @note 检查是否存在user、item两个table，如果不存在某个表则创建；同时打开用户名文件，将用户名信息读取到usernameSet中。
+     * @note 检查是否存在user、item两个table，如果不存在某个表则创建；新建user表时从旧版用户文件导入用户信息。
+     * @note 新建ledger表时为每个余额不为0的用户记一笔期初余额。
+     * @note 启动时补建item表缺少的二级索引。
+     * @note 日志模式、synchronous、mmap_size、cache_size从配置文件的[database]节读取；只接受持久的日志模式和不低于FULL的synchronous。
+     * @note 使用列式副本时，启动时把item表整表载入副本。
      *
      */
-    Database(const QString &connectionName, const QString &fileName);
+    Database(const QString &connectionName, const QString &fileName, bool columnarItems = false);
+
+    /**
+     * @brief 开始一组写入，之后的写入都放在同一个事务中
+     */
+    void beginGroupCommit();
+
+    /**
+     * @brief 提交这一组写入，所有写入共用一次落盘
+     * @return true 提交成功
+     * @return false 提交失败，这一组写入已回滚
+     * @note 先批量插入攒下的物品，再提交
+     * @note 提交成功后把这一组对item表的写入应用到列式副本上，失败则丢弃
+     */
+    bool commitGroupCommit();
+
+    /**
+     * @brief 开始这一组写入中的一个请求，用保存点把这个请求的写入与同组的其他请求隔开
+     * @note 不在一组写入中时什么也不做
+     */
+    void beginRequest();
+
+    /**
+     * @brief 结束这一组写入中的一个请求
+     * @param wrote 用于返回这个请求是否修改了数据库
+     * @return true 这个请求的写入都成功，已并入这一组
+     * @return false 这个请求中有写入失败，只撤销这个请求的写入，同组的其他请求不受影响
+     * @note 这个请求攒下的物品在这里用一次execBatch插入，插入失败也只撤销这个请求
+     * @note 撤销时回滚次数加一，上层的缓存据此重建
+     * @note 调用过abortRequest的请求也在这里撤销，但返回true，保留调用者给出的回复
+     */
+    bool endRequest(bool &wrote);
+
+    /**
+     * @brief 撤销当前请求到目前为止和之后的全部写入，在endRequest时回滚到请求保存点
+     * @return true 这个请求的写入会被撤销
+     * @return false 不在一组写入中，已经写入的无法撤销
+     * @note 用于一个请求中有多步写入、后一步失败时，代替手工补偿前几步的写入；请求的回复由调用者决定
+     */
+    bool abortRequest();
+
+    /**
+     * @brief 从CSV文件批量导入物品，保留文件中的单号
+     * @param in 输入流，第一行可以是表头
+     * @return int 导入的物品数，失败返回-1
+     * @note 写入前先完整检查一遍文件，有一行格式有误或单号在文件中重复则什么也不写
+     * @note 单号已在item表或归档表中的物品跳过，返回值不含跳过的物品
+     * @note 每BULK_BATCH_SIZE行一个事务，提交失败时只撤销当前这一批，之前的批次已经提交(记入日志)
+     * @note 格式与exportItems相同：单号,花费,类型,状态,寄送时间,接收时间,寄件人,收件人,快递员,描述，时间为"年-月-日"，未设置时为空
+     */
+    int importItems(QTextStream &in);
+
+    /**
+     * @brief 把所有物品按单号顺序导出为CSV文件
+     * @param out 输出流
+     * @return int 导出的物品数，失败返回-1
+     */
+    int exportItems(QTextStream &out) const;
+
+    /**
+     * @brief 从CSV文件批量导入用户，已存在的用户跳过
+     * @param in 输入流，第一行可以是表头
+     * @return int 导入的用户数，失败返回-1
+     * @note 写入前先完整检查一遍文件，有一行格式有误则什么也不写
+     * @note 余额作为一笔期初余额记入账本；每BULK_BATCH_SIZE个用户一个事务
+     * @note 格式与exportUsers相同：用户名,密码,类型,余额,姓名,电话号码,地址
+     */
+    int importUsers(QTextStream &in);
+
+    /**
+     * @brief 把所有用户导出为CSV文件
+     * @param out 输出流
+     * @return int 导出的用户数，失败返回-1
+     */
+    int exportUsers(QTextStream &out) const;
+
+    /**
+     * @brief 当前是否处在一组写入中
+     * @return true 处在一组写入中
+     * @return false 没有未提交的写入
+     */
+    bool inGroupCommit() const { return groupCommitting; }
+
+    /**
+     * @brief 获得写连接回滚过的次数
+     * @return int 回滚次数
+     * @note 上层的写穿缓存据此判断缓存中是否有没写进数据库的修改
+     */
+    int getRollbackCount() const { return rollbackCount; }
 
     /**
      * @brief 插入用户条目
@@ -58,8 +212,11 @@ public:
      * @param name 姓名
      * @param phoneNumber 电话号码
      * @param address 地址
+     * @return true 插入成功
+     * @return false 插入失败，或者该用户名在账本中还有记录
+     * @note 账本按用户名记账，删掉的用户名不能再注册，否则新用户会继承旧用户的流水
      */
-    void insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address);
+    bool insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address);
 
     /**
      * @brief 根据用户名查询用户是否存在
@@ -75,6 +232,14 @@ public:
      */
     int queryBalanceByName(const QString &username) const;
 
+    /**
+     * @brief 账本中是否有与该用户名有关的记录
+     * @param username 用户名
+     * @return true 有记录，包括已删除用户的记录
+     * @return false 没有记录
+     */
+    bool hasLedger(const QString &username) const;
+
     /**
      * @brief 修改用户密码
      *
@@ -92,9 +257,45 @@ public:
      * @param targetBalance 改后的余额
      * @return true 修改成功
      * @return false 修改失败
+     * @note 直接修改余额不会记入账本，余额变动应使用transferBalance
      */
     bool modifyUserBalance(const QString &targetUsername, int targetBalance) const;
 
+    /**
+     * @brief 转账：追加一条账本记录，并更新双方的余额
+     *
+     * @param srcName 付款用户的用户名，为空表示充值
+     * @param dstName 收款用户的用户名，为空表示提现
+     * @param amount 金额
+     * @param time 物流系统时间
+     * @return true 转账成功
+     * @return false 转账失败，账本和余额都没有变化
+     * @note 不检查余额是否足够，由调用者检查
+     */
+    bool transferBalance(const QString &srcName, const QString &dstName, int amount, const Time &time);
+
+    /**
+     * @brief 查询与某个用户有关的所有账本记录
+     * @param result 用于返回结果，按流水号排序
+     * @param username 用户名
+     * @return int 查到的记录数量
+     */
+    int queryLedgerByName(QList<LedgerEntry> &result, const QString &username) const;
+
+    /**
+     * @brief 按(快递员, 物流状态)分组统计物品数
+     * @param result 用于返回结果，快递员到各物流状态的物品数
+     * @note 用(快递员, 物流状态)索引完成，不读表
+     */
+    void queryItemCounts(QHash<QString, QHash<int, int>> &result) const;
+
+    /**
+     * @brief 按天统计某个用户转账的净收入，不含充值和提现
+     * @param result 用于返回结果，日序号到当天的净收入
+     * @param username 用户名
+     */
+    void queryDailyNetIncome(QMap<int, int> &result, const QString &username) const;
+
     /**
      * @brief 查询表中主键的最大值
      * @param tableName 数据库表名
@@ -102,6 +303,13 @@ public:
      */
     int getDBMaxId(const QString &tableName) const;
 
+    /**
+     * @brief 查询表中的行数
+     * @param tableName 数据库表名，"item"包括归档的物品
+     * @return int 行数，查询失败返回-1
+     */
+    int countRows(const QString &tableName) const;
+
     /**
      * @brief 插入物品
      *
@@ -115,8 +323,11 @@ public:
      * @param dstName 收件用户的用户名
      * @param expressman 快递员
      * @param description 物品描述
+     * @return true 插入成功，组提交中为已加入缓冲区
+     * @return false 插入失败
+     * @note 组提交中只加入待插入的缓冲区，插入失败会在请求结束时撤销这个请求
      */
-    void insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
+    bool insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
 
     /**
      * @brief 将文件的User查询结果转换成指向User的指针
@@ -129,82 +340,329 @@ public:
      * @param address 地址
      * @return QSharedPointer<User> 一个指向新创建的User类的指针
      */
-    QSharedPointer<User> query2User(const QString &username, QString &password, int &type, int &balance, QString &name, QString &phoneNumber, QString &address) const;
+    QSharedPointer<User> query2User(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address) const;
 
     /**
-     * @brief 将数据库的Item查询结果转换成指向Item的指针
+     * @brief 将数据库的User查询结果转换成指向User的指针
+     * @param sqlQuery User类的查询结果
+     * @return QSharedPointer<User> 一个指向新创建的User类的指针
+     */
+    QSharedPointer<User> query2User(const QSqlQuery &sqlQuery) const;
+
+    /**
+     * @brief 将数据库的Item查询结果转换成一行物品
      * @param sqlQuery Item类的查询结果
-     * @return QSharedPointer<Item> 一个指向新创建的Item类的指针
+     * @return ItemRow 这一行物品
      */
-    QSharedPointer<Item> query2Item(const QSqlQuery &sqlQuery) const;
+    ItemRow query2Row(const QSqlQuery &sqlQuery) const;
 
     /**
      * @brief 查询所有用户
      * @param result 用于返回结果
      * @return int 查到符合条件的数量
      */
-    int queryAllUser(QList<QSharedPointer<User>> &result);
+    int queryAllUser(QList<QSharedPointer<User>> &result) const;
+
+    /**
+     * @brief 逐个查询所有用户
+     * @param sink 每查到一个用户调用一次
+     * @return int 查到符合条件的数量
+     * @note sink中不能再访问数据库
+     */
+    int queryAllUser(const UserSink &sink) const;
 
     /**
      * @brief 根据条件查询物品
-     * @param result 用于返回结果
+     * @param sink 每查到一行调用一次，按排序方式的顺序
      * @param id 物品单号
      * @param state 物品状态
      * @param sendingTime 寄送时间
      * @param receivingTime 接收时间
      * @param srcName 寄件用户的用户名
      * @param dstName 收件用户的用户名
-     * @param expressman
+     * @param expressman 快递员的用户名
+     * @param sendingFrom 寄送时间的下限(含)，只给出年或年、月时从该年或该月的第一天算起
+     * @param sendingTo 寄送时间的上限(含)，只给出年或年、月时算到该年或该月的最后一天
+     * @param page 分页和排序方式
+     * @param descriptionContains 描述中包含的文字，为空表示不限
      * @return int 查到符合条件的数量
+     * @note 描述条件先在item_gram倒排索引中对首尾两个词项的倒排表求交，再对候选逐个确认包含该文字
+     * @note 时间按日序号列存储，给出年的时间条件和寄送时间范围都用索引的范围扫描完成
+     * @note 分页按(排序键, 单号)做键集分页，排序键都有索引，每页只读取该页的行
+     * @note 使用列式副本时，按单号排序的查询改为扫描副本；写线程在组提交中仍查数据库，以看到本组未提交的写入
+     * @note 状态、签收时间、寄送时间条件可能匹配归档物品时，用同样的条件再查一次归档表，两个游标按排序键归并
+     * @note 游标每前进一行就交给sink，不在内存中保存整个结果集；sink中不能再访问数据库
      */
-    int queryItemByFilter(QList<QSharedPointer<Item>> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &expressman, const QString &dstName) const;
+    int queryItemByFilter(const ItemSink &sink, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom = Time(-1, -1, -1), const Time &sendingTo = Time(-1, -1, -1), const ItemPage &page = ItemPage(), const QString &descriptionContains = "") const;
 
     /**
-     * @brief 修改物品状态
-     * @param id 物品单号
-     * @param state 物品状态
-     * @return true 修改成功
-     * @return false 修改失败
+     * @brief 根据条件查询物品，参数的含义同上
+     * @param result 用于返回结果，查到的行追加在末尾
+     * @return int 查到符合条件的数量
      */
-    bool modifyItemState(const int id, const int state);
+    int queryItemByFilter(QVector<ItemRow> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom = Time(-1, -1, -1), const Time &sendingTo = Time(-1, -1, -1), const ItemPage &page = ItemPage(), const QString &descriptionContains = "") const;
 
     /**
-     * @brief 修改物品的快递员
+     * @brief 修改物品的若干列
      * @param id 物品单号
-     * @param expressman 快递员的用户名
+     * @param patch 要修改的列
      * @return true 修改成功
-     * @return false 修改失败
+     * @return false 修改失败或没有要修改的列
+     * @note 所有给出的列在一条UPDATE语句中修改，要么都修改成功，要么都不修改
      */
-    bool modifyItemExpressman(const int id, const QString &expressman);
+    bool modifyItem(const int id, const ItemPatch &patch);
 
     /**
-     * @brief 修改物品接收时间
-     * @param id 物品单号
-     * @param receivingTime 接收时间
+     * @brief 按单号批量查询物品
+     * @param ids 物品单号，不能重复
+     * @param sink 每查到一行调用一次，顺序不定
+     * @return int 查到的数量，小于单号数说明有的单号不存在
+     * @note 每BULK_ID_CHUNK个单号用一条IN查询，不查归档表
+     * @note 只在写线程上调用
+     */
+    int queryItemsByIds(const QVector<int> &ids, const ItemSink &sink) const;
+
+    /**
+     * @brief 把一批物品的若干列改成相同的值
+     * @param ids 物品单号，不能重复
+     * @param patch 要修改的列
      * @return true 修改成功
-     * @return false 修改失败
+     * @return false 修改失败、有单号不存在或没有要修改的列
+     * @note 每BULK_ID_CHUNK个单号用一条UPDATE ... WHERE id IN (...)，全部在同一个事务中；
+     *       在一组写入中时用保存点，失败只撤销这一批的UPDATE，不会只改了一部分，也不影响同组的其他写入
+     * @note 只在写线程上调用
      */
-    bool modifyItemReceivingTime(const int id, const Time &receivingTime);
+    bool modifyItems(const QVector<int> &ids, const ItemPatch &patch);
 
     /**
-     * @brief 删除物品
+     * @brief 删除物品，item表中没有时从归档表删除
      * @param id 物品单号
      * @return true 删除成功
      * @return false 删除失败
      */
     bool deleteItem(const int id) const;
 
+    /**
+     * @brief 把签收日早于beforeDay的已签收物品移到归档表
+     * @param beforeDay 日序号，见Time::toDayNumber
+     * @param limit 这一次最多归档的物品数
+     * @return int 归档的物品数
+     * @note 复制和删除在同一个事务中；处在一组写入中时不归档
+     */
+    int archiveItems(int beforeDay, int limit);
+
     /**
      * @brief 删除用户
      * @param username 用户名
+     * @param time 物流系统时间
      * @return true 删除成功
-     * @return false 删除失败
+     * @return false 删除失败，账本和用户都没有变化
+     * @note 剩余的余额作为一笔提现记入账本，与删除在同一个事务中，账本中该用户的流水之和归零
      */
-    bool deleteUser(const QString username) const;
+    bool deleteUser(const QString username, const Time &time);
 
 private:
-    QSqlDatabase db;      // SQLite数据库
-    QString userFileName; //永久存储用户信息文件
+    /**
+     * @brief 旧版用户文件中的用户记录
+     */
+    struct UserRecord
+    {
+        QString password;    //密码
+        int type;            //用户类型
+        int balance;         //余额
+        QString name;        //姓名
+        QString phoneNumber; //电话号码
+        QString address;     //地址
+    };
+
+    /**
+     * @brief 工作线程的只读连接
+     */
+    struct ReadConnection
+    {
+        QSqlDatabase db;                         //只读连接
+        QHash<int, QSqlQuery> itemFilterQueries; //这个连接上按条件位掩码缓存的物品查询语句
+
+        /**
+         * @brief 析构函数，关闭并移除连接
+         * @note 线程结束时由QThreadStorage调用
+         */
+        ~ReadConnection();
+    };
+
+    QSqlDatabase db;                                          // SQLite数据库，唯一的写连接
+    QString userFileName;                                     //旧版用户信息文件，仅用于首次导入
+    bool groupCommitting;                                     //是否处在一组写入中
+    mutable QHash<QString, QSqlQuery> preparedQueries;        //按SQL语句缓存的预编译语句
+    mutable QHash<int, QSqlQuery> itemFilterQueries;          //按条件位掩码缓存的物品查询语句
+    QThread *writerThread;                                    //使用写连接的线程，即创建数据库的线程
+    QStringList connectionPragmas;                            //每个连接打开后执行的PRAGMA语句
+    mutable QThreadStorage<ReadConnection *> readConnections; //每个工作线程一个只读连接
+    mutable QAtomicInt readConnectionCount;                   //已创建的只读连接数，用于生成连接名
+    mutable QVector<QVariantList> pendingItems;               //组提交中等待批量插入的物品，每列一个QVariantList
+    mutable QVariantList pendingGrams;                        //组提交中等待批量插入的描述索引词项
+    mutable QVariantList pendingGramIds;                      //与pendingGrams对应的单号
+    mutable bool pendingItemsFailed;                          //本请求(或本批导入)的批量插入是否失败过，失败则撤销
+    bool requestAborted;                                      //本请求是否要求撤销自己的全部写入
+    int requestChanges;                                       //请求开始时写连接的total_changes()
+    int requestColumnMark;                                    //请求开始时列式副本中待应用的写入数
+    int rollbackCount;                                        //写连接回滚过的次数
+    QScopedPointer<ColumnItemStore> itemColumns;              //item表的列式副本，为空则不使用
+    QAtomicInt archivedUntil;                                 //归档表中最晚的签收日序号，归档表为空时为-1
+
+    /**
+     * @brief 用一次execBatch插入组提交中攒下的物品
+     * @return true 插入成功或没有待插入的物品
+     * @return false 插入失败，缓冲区已清空，这个请求结束时(批量导入时为这一批提交时)会撤销
+     * @note 只在写线程上调用
+     */
+    bool flushPendingItems() const;
+
+    /**
+     * @brief 用一次execBatch插入描述索引的词项
+     * @param grams 词项
+     * @param ids 对应的单号
+     * @return true 插入成功
+     * @return false 插入失败
+     */
+    bool insertGrams(const QVariantList &grams, const QVariantList &ids) const;
+
+    /**
+     * @brief 创建item_gram表，并为已有的物品(含归档的)建立描述索引
+     */
+    void createDescriptionIndex();
+
+    /**
+     * @brief 把一个物品加入等待批量插入的缓冲区，同时记入列式副本
+     */
+    void appendPendingItem(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
+
+    /**
+     * @brief 撤销这一组写入
+     */
+    void rollbackGroupCommit();
+
+    /**
+     * @brief 把item表整表载入列式副本
+     */
+    void loadItemColumns();
+
+    /**
+     * @brief 不在组提交中时，立即把对item表的写入应用到列式副本上
+     */
+    void commitItemColumns() const;
+
+    /**
+     * @brief 从配置文件读取PRAGMA设置，并应用到写连接上
+     * @note 只设置固定的几个PRAGMA；关键字取值须在允许的集合中，数值取值须是范围内的整数，否则用默认值
+     */
+    void configure();
+
+    /**
+     * @brief 获得当前线程的只读连接，第一次使用时打开
+     * @return ReadConnection* 只读连接
+     */
+    ReadConnection *readConnection() const;
+
+    /**
+     * @brief 获得预编译的SQL语句，第一次使用时编译并缓存
+     * @param queryString SQL语句
+     * @return QSqlQuery 与缓存共享同一个预编译语句
+     * @note 查询语句读完结果后需要调用finish()，以免一直占用数据库的读锁
+     */
+    QSqlQuery preparedQuery(const QString &queryString) const;
+
+    /**
+     * @brief 获得某种条件组合对应的预编译物品查询语句
+     * @param filterMask 条件位掩码，见ItemFilter
+     * @return QSqlQuery 与缓存共享同一个预编译语句
+     * @note 在写线程以外调用时使用该线程的只读连接
+     */
+    QSqlQuery preparedItemFilterQuery(int filterMask) const;
+
+    /**
+     * @brief 生成某种条件组合对应的物品查询语句
+     * @param filterMask 条件位掩码，见ItemFilter
+     * @return QString SQL语句
+     */
+    static QString itemFilterQueryString(int filterMask);
+
+    /**
+     * @brief 生成item表的建表语句
+     * @param tableName 表名
+     * @return QString SQL语句
+     * @note 寄送时间和接收时间各存为一个日序号列，见Time::toDayNumber
+     * @note 单号与旧版一样是INT PRIMARY KEY(不是rowid的别名)，迁移前后的表结构和单号语义一致
+     */
+    static QString itemTableDefinition(const QString &tableName);
+
+    /**
+     * @brief 把按年、月、日分列存储时间的旧版item表迁移为日序号列
+     */
+    void migrateItemTable();
+
+    /**
+     * @brief 创建item表或归档表上缺少的二级索引
+     * @param tableName 表名，索引名以表名开头
+     * @note 寄件人、收件人、快递员各有一个(用户名, 物流状态)的组合索引，另有一个物流状态索引
+     */
+    void createItemIndexes(const QString &tableName);
+
+    /**
+     * @brief 检查UserManage::queryItem的各种查询是否都按预期的索引查找，分页查询是否不用排序
+     * @return true 每种查询的计划都符合预期
+     * @return false 有查询的计划不符合预期，每个不符合的查询都已记入错误日志
+     * @note 只认按预期索引的SEARCH步骤，SCAN即使带USING INDEX也算没用上索引
+     */
+    bool checkItemIndexes() const;
+
+    /**
+     * @brief 创建ledger表，并为每个余额不为0的用户记一笔期初余额
+     */
+    void createLedger();
+
+    /**
+     * @brief 将旧版用户快照文件及其日志导入user表
+     * @return true 导入成功，或者没有旧版用户文件
+     * @return false 导入失败
+     * @note 不开启事务，由调用者把建表和导入放在同一个事务中
+     */
+    bool importUserFile();
+
+    /**
+     * @brief 导入提交后将旧版用户文件及其日志重命名为*.imported，避免重复导入
+     * @note 重命名失败只记日志：user表已存在，不会再导入
+     */
+    void renameImportedUserFile() const;
+
+    /**
+     * @brief 旧版用户快照文件中的一块，由一个线程解析
+     */
+    struct UserChunk
+    {
+        const char *begin;                          //块的起始位置
+        const char *end;                            //块的结束位置
+        QVector<QPair<QString, UserRecord>> users; //解析结果
+    };
+
+    /**
+     * @brief 读取旧版用户快照文件
+     * @param users 用于返回结果
+     * @note 映射整个文件，按行边界切成若干块后并行解析
+     */
+    void loadUserSnapshot(QHash<QString, UserRecord> &users) const;
+
+    /**
+     * @brief 解析旧版用户快照文件中的一块
+     * @param chunk 文件块
+     */
+    static void parseUserChunk(UserChunk &chunk);
+
+    /**
+     * @brief 重放旧版用户日志，将快照之后的修改应用到users
+     * @param users 用户快照
+     */
+    void replayUserLog(QHash<QString, UserRecord> &users) const;
 
     /**
      * @brief 执行SQL语句
@@ -228,7 +686,7 @@ private:
      * @param key 需要修改的键
      * @param value 修改的值
      * @return true 修改成功
-     * @return false 修改失败
+     * @return false 修改失败或记录不存在
      */
     bool modifyData(const QString &tableName, const QString &primaryKey, const QString &key, int value) const;
 
@@ -239,7 +697,7 @@ private:
      * @param key 需要修改的键
      * @param value 修改的值
      * @return true 修改成功
-     * @return false 修改失败
+     * @return false 修改失败或记录不存在
      */
     bool modifyData(const QString &tableName, const QString &primaryKey, const QString &key, const QString value) const;
 };
@@ -0,0 +1,153 @@
+﻿/**
+ * @file dispatcher.h
+ * @author Haolin Yang
+ * @brief 自动派单类的声明
+ * @version 0.1
+ * @date 2022-05-31
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 维护每个快递员的负载(名下待揽收的物品数)和未分配快递员的待揽收物品队列，寄出快递时按策略直接选出快递员，
+ *       不必再由管理员逐个指派。
+ * @note 负载和队列随物品的插入、修改、删除增量更新，选快递员只查有序索引，不扫描item表。
+ * @note 没有快递员时新物品进入队列，添加快递员后按同样的策略把队列中的物品分批派出。
+ * @note 启动时从数据库建立索引；数据库回滚过时索引可能含有未写入的修改，下次派单前重建。
+ * @note 只在写线程上使用。
+ */
+
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <QHash>
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include <set>
+#include <utility>
+
+#include "item.h"
+
+class Database;
+
+const int DISPATCH_MANUAL = 0;       //不自动派单，由管理员指派
+const int DISPATCH_LEAST_LOADED = 1; //派给负载最小的快递员，负载相同的按用户名
+const int DISPATCH_ROUND_ROBIN = 2;  //按用户名轮流派给各快递员
+
+/**
+ * @brief 自动派单类
+ */
+class Dispatcher
+{
+public:
+    /**
+     * @brief 删除默认构造函数
+     */
+    Dispatcher() = delete;
+
+    /**
+     * @brief 构造函数，从数据库建立索引
+     * @param _db 数据库的指针
+     * @param _policy 派单策略
+     */
+    Dispatcher(Database *_db, int _policy);
+
+    /**
+     * @brief 获得派单策略
+     * @return int 派单策略
+     */
+    int getPolicy() const { return policy; }
+
+    /**
+     * @brief 为一个新物品选出快递员
+     * @return QString 快递员的用户名，不自动派单或没有快递员时返回UNASSIGNED_EXPRESSMAN
+     * @note 只选出快递员，负载在插入物品后由itemInserted更新
+     */
+    QString pick();
+
+    /**
+     * @brief 为队列中最早的一批物品选出快递员
+     * @param limit 最多派出的物品数
+     * @return QHash<QString, QVector<int>> 快递员到派给他的单号
+     * @note 只给出计划，负载和队列在修改物品后由itemModified更新
+     */
+    QHash<QString, QVector<int>> planQueued(int limit);
+
+    /**
+     * @brief 获得队列中的物品数
+     * @return int 物品数
+     */
+    int queuedCount() const;
+
+    /**
+     * @brief 记录插入了一个物品
+     * @param id 单号
+     * @param state 物品状态
+     * @param expressman 快递员
+     */
+    void itemInserted(int id, int state, const QString &expressman);
+
+    /**
+     * @brief 记录修改了一个物品
+     * @param id 单号
+     * @param state 修改前的物品状态
+     * @param expressman 修改前的快递员
+     * @param patch 修改的列
+     */
+    void itemModified(int id, int state, const QString &expressman, const ItemPatch &patch);
+
+    /**
+     * @brief 记录删除了一个物品
+     * @param id 单号
+     * @param state 物品状态
+     * @param expressman 快递员
+     */
+    void itemDeleted(int id, int state, const QString &expressman);
+
+    /**
+     * @brief 记录添加了一个快递员
+     * @param expressman 快递员的用户名
+     */
+    void expressmanAdded(const QString &expressman);
+
+    /**
+     * @brief 记录删除了一个快递员，之后不再派单给他
+     * @param expressman 快递员的用户名
+     * @note 他名下未揽收的物品由调用者退回待分配后再rebuild，才会重新进入队列
+     */
+    void expressmanRemoved(const QString &expressman);
+
+    /**
+     * @brief 从数据库重建索引
+     * @note 批量导入后调用
+     */
+    void rebuild();
+
+private:
+    Database *db;                                 //数据库
+    int policy;                                   //派单策略
+    QMap<QString, int> loads;                     //快递员到名下待揽收的物品数，按用户名排序
+    std::set<std::pair<int, QString>> byLoad;     //按(负载, 用户名)排序的快递员
+    std::set<int> queued;                         //未分配快递员的待揽收物品，按单号即寄出的先后排序
+    QString lastPicked;                           //轮流派单时上一次派给的快递员
+    int seenRollbackCount;                        //索引对应的数据库回滚次数
+
+    /**
+     * @brief 数据库回滚过则重建索引
+     */
+    void checkRollback();
+
+    /**
+     * @brief 按策略选出快递员，不检查回滚
+     * @return QString 快递员的用户名，没有快递员时返回UNASSIGNED_EXPRESSMAN
+     */
+    QString choose();
+
+    /**
+     * @brief 改变一个快递员的负载
+     * @param expressman 快递员的用户名，不是已知的快递员时忽略
+     * @param delta 改变量
+     */
+    void adjust(const QString &expressman, int delta);
+};
+
+#endif
@@ -0,0 +1,87 @@
+﻿/**
+ * @file idallocator.h
+ * @author Haolin Yang
+ * @brief 分块ID分配器类的声明
+ * @version 0.1
+ * @date 2022-05-29
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 全局只有一个持久化的高水位线，每次从中预留一整块ID；每个线程从自己的块中分配，用完再预留下一块。
+ * @note 预留时先把新的高水位线写入文件(QSaveFile原子替换)，再把这一块交给线程，崩溃后重启不会重复分配ID，最多留下空号。
+ * @note 多个进程共用同一个文件时，用QLockFile互斥地读取和推进高水位线。
+ * @note 文件丢失或损坏时，以数据库中最大的ID为高水位线。
+ */
+
+#ifndef IDALLOCATOR_H
+#define IDALLOCATOR_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QString>
+#include <QThreadStorage>
+
+const int ID_BLOCK_SIZE = 64; //每次预留的ID数
+
+/**
+ * @brief 分块ID分配器类
+ */
+class IdAllocator
+{
+public:
+    /**
+     * @brief 删除默认构造函数
+     */
+    IdAllocator() = delete;
+
+    /**
+     * @brief 构造函数
+     * @param _fileName 保存高水位线的文件
+     * @param _blockSize 每次预留的ID数
+     */
+    IdAllocator(const QString &_fileName, int _blockSize = ID_BLOCK_SIZE);
+
+    /**
+     * @brief 分配一个ID
+     * @return int 新ID，失败返回-1
+     * @note 线程安全
+     */
+    int allocate();
+
+    /**
+     * @brief 保证之后分配的ID都大于floor，并作废各线程手中的块
+     * @param floor 已被使用的最大ID，例如数据库中最大的ID
+     * @return true 成功
+     * @return false 写入高水位线失败
+     * @note 启动时和批量导入后调用
+     */
+    bool raiseTo(int floor);
+
+private:
+    /**
+     * @brief 一个线程手中的ID块
+     */
+    struct Block
+    {
+        int next = 0;       //下一个可分配的ID
+        int end = 0;        //块的末尾(不含)
+        int generation = 0; //预留时的代数，与当前代数不同则作废
+    };
+
+    QString fileName;                   //保存高水位线的文件
+    int blockSize;                      //每次预留的ID数
+    QMutex mutex;                       //进程内预留时互斥
+    QAtomicInt generation;              //raiseTo时加一，作废所有已预留的块
+    QThreadStorage<Block *> blocks;     //每个线程手中的块
+
+    /**
+     * @brief 推进高水位线
+     * @param floor 新的高水位线至少为floor + count
+     * @param count 预留的ID数
+     * @return int 这一块的第一个ID，失败返回-1
+     * @note 调用时持有mutex
+     */
+    int reserve(int floor, int count);
+};
+
+#endif
@@ -18,7 +18,12 @@
 #define DEBUG
 
 #include <QSharedPointer>
+#include <QCache>
 #include <QDebug>
+#include <QVector>
+#include <functional>
+#include "idallocator.h"
+#include "nametable.h"
 #include "time.h"
 
 const int PENDING_COLLECTING = 1; //待揽收
@@ -33,7 +38,94 @@ const int FRAGILE_ITEM_PRICE = 8; //易碎品单价
 const int BOOK_PRICE = 2;         //图书单价
 const int NORMAL_ITEM_PRICE = 5;  //普通快递单价
 
+const int ORDER_BY_ID = 0;           //按单号排序
+const int ORDER_BY_SENDING_TIME = 1; //按寄送时间排序，同一天的按单号
+const int MAX_ITEM_PAGE_SIZE = 1000; //分页查询时每页最多的物品数
+const int MAX_BULK_ITEMS = 1000;     //批量指派、运送、签收时一次最多的物品数
+const int ITEM_CACHE_SIZE = 4096;    //按单号缓存的物品数上限
+const QString ITEM_ID_FILE_NAME("../data/item.id"); //物品单号的高水位线文件
+const QString UNASSIGNED_EXPRESSMAN("未分配");       //尚未指派快递员的物品的快递员
+
+/**
+ * @brief 按物品类型查单价
+ * @param type 物品类型
+ * @return int 单价，类型有误时返回0
+ */
+inline int itemPrice(int type)
+{
+    static const int prices[] = {0, FRAGILE_ITEM_PRICE, BOOK_PRICE, NORMAL_ITEM_PRICE};
+    return type >= FRAGILE && type <= NORMAL ? prices[type] : 0;
+}
+
+/**
+ * @brief 对一件物品的一组修改
+ * @note 给出的各列在同一条UPDATE语句中修改，一次状态变化只写一次这一行
+ */
+struct ItemPatch
+{
+    int state = -1;                        //新的物品状态，-1表示不修改
+    Time receivingTime = Time(-1, -1, -1); //新的接收时间，年为-1表示不修改
+    QString expressman;                    //新的快递员，空串表示不修改
+};
+
+/**
+ * @brief 分页查询的参数
+ * @note 使用键集分页：下一页从上一页最后一条的排序键之后开始，不用OFFSET，翻到多深每页的代价都一样
+ */
+struct ItemPage
+{
+    int limit = -1;            //每页最多几条，-1表示不分页
+    int orderBy = ORDER_BY_ID; //排序方式
+    int afterKey = -1;         //上一页最后一条的寄送日序号，仅按寄送时间排序时使用
+    int afterId = -1;          //上一页最后一条的单号，-1表示从第一页开始
+};
+
+/**
+ * @brief 查询结果中的一行物品
+ * @note 没有虚函数的值类型，查询结果连续存放在QVector<ItemRow>中，不必为每行单独分配对象
+ * @note 时间以日序号存放，需要时再转换为Time
+ */
+struct ItemRow
+{
+    int id;              //物品单号
+    int cost;            //总花费
+    int type;            //物品类型
+    int state;           //物品状态
+    int sendingDay;      //寄送日序号
+    int receivingDay;    //接收日序号，-1表示未接收
+    QString srcName;     //寄件用户的用户名
+    QString dstName;     //收件用户的用户名
+    QString expressman;  //快递员的用户名
+    QString description; //物品描述
+
+    /**
+     * @brief 获得寄送时间
+     * @return Time 寄送时间
+     */
+    Time sendingTime() const { return Time::fromDayNumber(sendingDay); }
+
+    /**
+     * @brief 获得接收时间
+     * @return Time 接收时间
+     */
+    Time receivingTime() const { return Time::fromDayNumber(receivingDay); }
+
+    /**
+     * @brief 获得单价，按类型查表
+     * @return int 单价
+     */
+    int price() const { return itemPrice(type); }
+};
+
+/**
+ * @brief 逐行接收查询结果的回调
+ * @note 游标每前进一行就调用一次，传入的行只在调用期间有效，调用方不必先把整个结果集存下来
+ */
+typedef std::function<void(const ItemRow &)> ItemSink;
+
 class Database;
+class Statistics;
+class Dispatcher;
 class Time;
 
 /**
@@ -61,7 +153,7 @@ public:
      * @param _description 物品描述
      * @note 注意是否使用std::move
      */
-    Item(int _id, int _cost, int _state, Time _sendingTime, Time _receivingTime, QString _srcName, QString _dstName, QString _expressman, QString _description) : id(_id), cost(_cost), state(_state), sendingTime(_sendingTime), receivingTime(_receivingTime), srcName(_srcName), dstName(_dstName), expressman(_expressman), description(_description)
+    Item(int _id, int _cost, int _state, Time _sendingTime, Time _receivingTime, QString _srcName, QString _dstName, QString _expressman, QString _description) : id(_id), cost(_cost), state(_state), sendingTime(_sendingTime), receivingTime(_receivingTime), srcName(NameTable::intern(_srcName)), dstName(NameTable::intern(_dstName)), expressman(NameTable::intern(_expressman)), description(_description)
     {
 #ifdef DEBUG
         qDebug() << "构造item";
@@ -144,8 +236,23 @@ public:
     /**
      * @brief 插入快递信息到数据库中
      * @param db 数据库
+     * @return true 插入成功
+     * @return false 插入失败
      */
-    void insertInfo2DB(Database *db);
+    bool insertInfo2DB(Database *db);
+
+    /**
+     * @brief 把一组修改应用到这个物品上
+     * @param patch 要修改的列
+     */
+    void apply(const ItemPatch &patch);
+
+    /**
+     * @brief 由查询结果的一行创建对应类型的物品对象
+     * @param row 查询结果的一行
+     * @return QSharedPointer<Item> 新创建的物品，类型有误时为空
+     */
+    static QSharedPointer<Item> fromRow(const ItemRow &row);
 
 protected:
     int id;              // 物品ID 主键
@@ -277,8 +384,10 @@ public:
     /**
      * @brief 构造函数
      * @param _db 数据库的指针
+     * @param _stats 统计数据的指针，插入、修改、删除物品时更新
+     * @param _dispatcher 自动派单的指针，插入、修改、删除物品时更新快递员的负载和待分配队列
      */
-    ItemManage(Database *_db);
+    ItemManage(Database *_db, Statistics *_stats, Dispatcher *_dispatcher);
 
     /**
      * @brief 插入一个Item，会自动分配id.
@@ -291,9 +400,10 @@ public:
      * @param srcName 寄件用户的用户名
      * @param dstName 收件用户的用户名
      * @param description 物品描述
-     * @return int 为添加的快递分配的单号
+     * @return int 为添加的快递分配的单号，分配或插入失败返回-1，此时不改缓存和统计
      *
      * @note pahse1默认cost为15
+     * @note 单号由分块ID分配器分配，各线程互不阻塞；单号唯一但不保证按插入顺序递增
      */
     int insertItem(
         const int cost,
@@ -308,14 +418,14 @@ public:
 
     /**
      * @brief 查询所有物品
-     * @param result 用于返回结果
+     * @param sink 每查到一行调用一次
      * @return int 查到符合条件的数量
      */
-    int queryAll(QList<QSharedPointer<Item>> &result) const;
+    int queryAll(const ItemSink &sink) const;
 
     /**
      * @brief 根据条件查询物品
-     * @param result 用于返回结果
+     * @param sink 每查到一行调用一次
      * @param id 物品单号
      * @param state 物品状态
      * @param sendingTime 寄送时间
@@ -323,46 +433,49 @@ public:
      * @param srcName 寄件用户的用户名
      * @param dstName 收件用户的用户名
      * @param expressman 快递员的用户名
+     * @param sendingFrom 寄送时间的下限(含)
+     * @param sendingTo 寄送时间的上限(含)
+     * @param page 分页和排序方式
+     * @param descriptionContains 描述中包含的文字
      * @return int 查到符合条件的数量
      */
-    int queryByFilter(QList<QSharedPointer<Item>> &result, const int id = -1, const int state = -1, const Time &sendingTime = Time(-1, -1, -1), const Time &receivingTime = Time(-1, -1, -1), const QString &srcName = "", const QString &dstName = "", const QString &expressman = "") const;
+    int queryByFilter(const ItemSink &sink, const int id = -1, const int state = -1, const Time &sendingTime = Time(-1, -1, -1), const Time &receivingTime = Time(-1, -1, -1), const QString &srcName = "", const QString &dstName = "", const QString &expressman = "", const Time &sendingFrom = Time(-1, -1, -1), const Time &sendingTo = Time(-1, -1, -1), const ItemPage &page = ItemPage(), const QString &descriptionContains = "") const;
 
     /**
-     * @brief 根据条件查询物品
+     * @brief 根据单号查询物品
      * @param result 用于返回结果
      * @param id 物品单号
      * @return true 存在该物品
      * @return false 不存在该物品
+     * @note 先查缓存，缓存中没有再查数据库；只在写线程上调用
      */
     bool queryById(QSharedPointer<Item> &result, const int id) const;
 
     /**
-     * @brief 修改物品状态
+     * @brief 修改物品的若干列
      * @param id 物品单号
-     * @param state 物品状态
+     * @param patch 要修改的列
      * @return true 修改成功
      * @return false 修改失败
      */
-    bool modifyState(const int id, const int state);
+    bool modify(const int id, const ItemPatch &patch);
 
     /**
-     * @brief 修改接收时间
-     *
-     * @param id 物品单号
-     * @param receivingTime 接收时间
-     * @return true 修改成功
-     * @return false 修改失败
+     * @brief 按单号批量查询物品
+     * @param ids 物品单号，不能重复
+     * @param result 用于返回结果，顺序不定
+     * @return int 查到的数量，小于单号数说明有的单号不存在
      */
-    bool modifyReceivingTime(const int id, const Time &receivingTime);
+    int queryByIds(const QVector<int> &ids, QVector<ItemRow> &result) const;
 
     /**
-     * @brief 修改物品的快递员
-     * @param id 物品单号
-     * @param expressman 快递员
+     * @brief 把一批物品的若干列改成相同的值
+     * @param before 修改前的物品，由queryByIds查得
+     * @param patch 要修改的列
      * @return true 修改成功
-     * @return false 修改失败
+     * @return false 修改失败，所有物品都没有修改
      */
-    bool modifyExpressman(const int id, const QString &expressman);
+    bool modifyBatch(const QVector<ItemRow> &before, const ItemPatch &patch);
 
     /**
      * @brief 从数据库中删除对应id的物品
@@ -372,8 +485,23 @@ public:
      */
     bool deleteItem(const int id) const;
 
+    /**
+     * @brief 批量导入物品后，让之后的单号大于数据库中最大的单号，并清空缓存
+     */
+    void reload();
+
 private:
-    Database *db; //数据库
-    int total;    //物品ID允许的最大值
+    Database *db;                                        //数据库
+    Statistics *stats;                                   //统计数据
+    Dispatcher *dispatcher;                              //自动派单
+    IdAllocator idAllocator;                             //单号分配器
+    mutable QCache<int, QSharedPointer<Item>> itemCache; //按单号缓存最近用到的物品，插入、修改、删除时同步更新
+    mutable int seenRollbackCount;                       //缓存对应的数据库回滚次数，数据库回滚过则清空缓存
+
+    /**
+     * @brief 把物品放入缓存
+     * @param item 物品
+     */
+    void cacheItem(const QSharedPointer<Item> &item) const;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,156 @@
+﻿/**
+ * @file itemstore.h
+ * @author Haolin Yang
+ * @brief 列式物品副本类的声明
+ * @version 0.1
+ * @date 2022-05-27
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note item表在内存中的只读副本，按列存放：单号、花费、类型、状态、寄送日序号、接收日序号是紧凑的int数组，
+ *       寄件人、收件人、快递员用字典编码为int，描述单独存放，只在生成结果时读取。
+ * @note 查询时每个条件对整列做一遍简单的比较循环，结果与到选择掩码上(每行一个字节)，编译器可以自动向量化，
+ *       没有索引的条件组合也只是顺序扫描几列int。
+ * @note 副本按单号升序排列，只支持按单号排序的查询(包括按单号的键集分页)。
+ * @note 写入先记在待应用的列表中，数据库提交后才应用到副本上，回滚则丢弃，工作线程的查询不会看到未提交的写入。
+ * @note 删除只把行标为已删除；已删除的行超过总行数的四分之一时，提交后整体压缩一次，同时重建用户名字典。
+ */
+
+#ifndef ITEMSTORE_H
+#define ITEMSTORE_H
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
+#include <functional>
+
+#include "item.h"
+
+const int COLUMN_SCAN_CHUNK = 4096;      //列式副本每次扫描的行数
+const int COLUMN_COMPACT_MIN_DEAD = 1024; //列式副本中已删除的行至少这么多才压缩
+
+/**
+ * @brief 列式物品副本类
+ */
+class ColumnItemStore
+{
+public:
+    ColumnItemStore() = default;
+
+    /**
+     * @brief 插入一个物品，提交后生效
+     *
+     * @param id 单号
+     * @param cost 总花费
+     * @param type 物品类型
+     * @param state 物品状态
+     * @param sendingDay 寄送日序号
+     * @param receivingDay 接收日序号
+     * @param srcName 寄件用户的用户名
+     * @param dstName 收件用户的用户名
+     * @param expressman 快递员
+     * @param description 物品描述
+     */
+    void insert(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description);
+
+    /**
+     * @brief 修改一个物品，提交后生效
+     * @param id 单号
+     * @param patch 要修改的列
+     */
+    void modify(int id, const ItemPatch &patch);
+
+    /**
+     * @brief 删除一个物品，提交后生效
+     * @param id 单号
+     */
+    void remove(int id);
+
+    /**
+     * @brief 把待应用的写入应用到副本上
+     */
+    void commit();
+
+    /**
+     * @brief 丢弃待应用的写入
+     */
+    void rollback();
+
+    /**
+     * @brief 获得待应用的写入数，作为rollbackTo的标记
+     * @return int 待应用的写入数
+     */
+    int pendingCount() const { return pending.size(); }
+
+    /**
+     * @brief 只丢弃标记之后记下的写入
+     * @param mark 之前由pendingCount取得的标记
+     */
+    void rollbackTo(int mark);
+
+    /**
+     * @brief 获得副本中的物品数
+     * @return int 物品数(不含已删除的)
+     */
+    int size() const;
+
+    /**
+     * @brief 根据条件查询物品，参数的含义与Database::queryItemByFilter相同
+     * @param sink 每查到一行调用一次
+     * @return int 查到符合条件的数量，不支持该查询(按寄送时间排序)时返回-1
+     * @note 可以在任意线程上调用
+     * @note 调用sink时持有读锁，sink中不能修改副本
+     */
+    int query(const ItemSink &sink, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom, const Time &sendingTo, const ItemPage &page) const;
+
+private:
+    mutable QReadWriteLock lock; //查询加读锁，应用写入时加写锁
+
+    QVector<int> ids;              //单号，升序
+    QVector<int> costs;            //总花费
+    QVector<int> types;            //物品类型
+    QVector<int> states;           //物品状态
+    QVector<int> sendingDays;      //寄送日序号
+    QVector<int> receivingDays;    //接收日序号
+    QVector<int> srcNames;         //寄件用户的用户名编码
+    QVector<int> dstNames;         //收件用户的用户名编码
+    QVector<int> expressmen;       //快递员的用户名编码
+    QVector<QString> descriptions; //物品描述
+    QVector<quint8> alive;         //该行是否未被删除
+    int aliveCount = 0;            //未被删除的行数
+
+    QVector<QString> names;        //编码到用户名
+    QHash<QString, int> nameCodes; //用户名到编码
+
+    QVector<std::function<void()>> pending; //待应用的写入，只在写线程上访问
+
+    /**
+     * @brief 去掉已删除的行，并只保留仍被引用的用户名编码
+     * @note 只在持有写锁时调用
+     */
+    void compact();
+
+    /**
+     * @brief 获得用户名的编码，没有则分配一个
+     * @param name 用户名
+     * @return int 编码
+     * @note 只在持有写锁时调用
+     */
+    int encode(const QString &name);
+
+    /**
+     * @brief 查找单号所在的行
+     * @param id 单号
+     * @return int 行号，不存在则返回-1
+     */
+    int rowOf(int id) const;
+
+    /**
+     * @brief 把一行交给sink，用户名和描述与副本共享数据，不复制字符串
+     * @param sink 接收结果的回调
+     * @param row 行号
+     */
+    void emitRow(const ItemSink &sink, int row) const;
+};
+
+#endif
@@ -0,0 +1,61 @@
+﻿/**
+ * @file nametable.h
+ * @author Haolin Yang
+ * @brief 用户名驻留表类的声明
+ * @version 0.1
+ * @date 2022-05-30
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 物品的寄件人、收件人、快递员几乎都是少数几个用户名和"未分配"，每行各自持有一份QString很浪费。
+ * @note 驻留后相同的用户名共享同一份QString数据(隐式共享)，长期持有用户名的物品缓存、列式副本和会话表都只多一个引用计数。
+ * @note 只在这些长期持有者中驻留；查询结果只活一个请求，工作线程上逐行驻留只会争用全局锁，不驻留。
+ *       需要逐行比较用户名的列式副本把用户名编码为int，比较编码而不是字符串。
+ * @note 只驻留用户名这类取值很少的字符串，物品描述等不驻留。表的大小到上次清理后的两倍时，清掉只剩表本身引用的用户名，
+ *       表的大小不超过仍在使用的用户名数的两倍。
+ */
+
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include <QReadWriteLock>
+#include <QSet>
+#include <QString>
+
+const int NAME_TABLE_MIN_PURGE_SIZE = 1024; //用户名驻留表至少到这么大才清理
+
+/**
+ * @brief 用户名驻留表类
+ * @note 全局唯一，可以在任意线程上调用
+ */
+class NameTable
+{
+public:
+    NameTable() = delete;
+
+    /**
+     * @brief 驻留一个用户名
+     * @param name 用户名
+     * @return QString 与表中相同用户名共享数据的QString，第一次出现时加入表中
+     */
+    static QString intern(const QString &name);
+
+    /**
+     * @brief 获得表中的用户名数
+     * @return int 用户名数
+     */
+    static int size();
+
+private:
+    /**
+     * @brief 清掉只剩表本身引用的用户名
+     * @note 调用者持有写锁
+     */
+    static void purge();
+
+    static QReadWriteLock lock; //查找加读锁，加入新用户名时加写锁
+    static QSet<QString> names; //已驻留的用户名
+    static int purgeSize;       //表到这么大时清理一次
+};
+
+#endif
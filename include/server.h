@@ -14,17 +14,44 @@
 #include <QObject>
 #include <QUdpSocket>
 #include <QJsonValue>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "user.h"
 
+const int GROUP_COMMIT_WINDOW_MS = 2;   //组提交的等待窗口(毫秒)
+const int GROUP_COMMIT_BATCH_SIZE = 64; //组提交的最大请求数
+const int ARCHIVE_AGE_DAYS = 30;          //签收超过这么多天(物流系统时间)的物品归档，0表示不归档
+const int ARCHIVE_INTERVAL_MS = 60000;    //归档的间隔(毫秒)
+const int ARCHIVE_BATCH_SIZE = 10000;     //每次最多归档的物品数
+
 //服务器类
+//收到的请求先在同一个数据库事务中处理，窗口到期或请求数达到上限时统一提交，提交之后才发送回复
+//查询快递的请求不写数据库，交给线程池在只读连接上处理，处理完直接回复
+//后台定时把签收已久的物品归档，参数从配置文件的[archive]节读取
 class Server : public QObject
 {
     Q_OBJECT
 public:
-    Server(QObject *parent, quint16 _port, UserManage *_usermanage);
+    Server(QObject *parent, quint16 _port, UserManage *_usermanage, Database *_db);
+
+    /**
+     * @brief 析构函数，等待进行中的查询，并提交还未提交的请求
+     */
+    ~Server();
 
 private:
+    /**
+     * @brief 等待组提交的回复
+     */
+    struct PendingReply
+    {
+        QByteArray data;      //回复内容
+        QHostAddress address; //客户端地址
+        quint16 port;         //客户端端口
+        bool wrote;           //这个请求是否修改了数据库，整组提交失败时只改写这些请求的回复
+    };
+
     enum RequestType
     {
         time,             //查询系统时间
@@ -43,7 +70,14 @@ private:
         query,            //查询符合条件的快递
         send,             //发送快递
         receive,          //接收快递
-        deleteItem        //删除快递
+        deleteItem,       //删除快递
+        history,          //查询账目
+        stats,            //查询统计数据
+        importData,       //从CSV文件批量导入物品或用户
+        exportData,       //把物品或用户导出为CSV文件
+        assignBatch,      //为一批快递指定同一个快递员
+        deliveryBatch,    //运送一批快递
+        receiveBatch      //接收一批快递
     };
 
     /**
@@ -51,6 +85,26 @@ private:
      */
     void messageHandler();
 
+    /**
+     * @brief 提交这一组请求的写入，并发送这一组请求的回复
+     * @note 提交失败时，修改过数据库的请求回复失败，没有写入的请求(如登录、查询)照常回复
+     */
+    void flushGroupCommit();
+
+    /**
+     * @brief 归档签收超过archiveAgeDays天的物品
+     * @note 先提交攒下的写入，归档不与请求放在同一个事务中
+     */
+    void archiveItems();
+
+    /**
+     * @brief 在线程池上处理查询快递的请求，处理完后回复
+     * @param payload 有效载荷
+     * @param address 客户端地址
+     * @param port 客户端端口
+     */
+    void startQuery(const QJsonObject &payload, const QHostAddress &address, quint16 port);
+
     /**
      * @brief 将凭据打包成JWT token字符串
      * @param payload 凭据
@@ -98,7 +152,14 @@ private:
     void constructRet(QJsonObject &ret, const QString &res, const QJsonValue &result) const;
 
     UserManage *userManage;
+    Database *db;
     QUdpSocket socket;
+    QTimer groupCommitTimer;            //组提交窗口计时器
+    QList<PendingReply> pendingReplies; //等待组提交的回复
+    QThreadPool queryPool;              //处理查询快递请求的线程池，线程数从配置文件的[server]节读取
+    QTimer archiveTimer;                //归档计时器
+    int archiveAgeDays;                 //签收超过这么多天的物品归档
+    int archiveBatchSize;               //每次最多归档的物品数
     const QByteArray secret = "JWTTokenSecret"; // JWT token 加密密钥
 
     /**
@@ -196,6 +257,7 @@ private:
      * @param payload 有效载荷
      * @return QByteArray
      * @note 包括各种类型的快递查询：管理员：所有快递 用户：寄件 收件 快递员：所属的快递
+     * @note 分页查询时若还有下一页，回复中另带一个"cursor"键
      */
     QByteArray queryHandler(const QJsonObject &payload) const;
 
@@ -219,6 +281,55 @@ private:
      * @return QByteArray
      */
     QByteArray deleteItemHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 查询账目
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray historyHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 查询统计数据
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray statsHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 批量导入
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray importDataHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 批量导出
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray exportDataHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 为一批快递指定同一个快递员
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray assignBatchHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 处理运送一批快递
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray deliveryBatchHandler(const QJsonObject &payload) const;
+
+    /**
+     * @brief 处理接收一批快递
+     * @param payload 有效载荷
+     * @return QByteArray
+     */
+    QByteArray receiveBatchHandler(const QJsonObject &payload) const;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+﻿/**
+ * @file stats.h
+ * @author Haolin Yang
+ * @brief 统计数据类的声明
+ * @version 0.1
+ * @date 2022-05-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * @note 统计各物流状态的物品数、每天的营收(管理员账户每天的净收入)、每个快递员名下各状态的物品数。
+ * @note 计数器在插入、修改、删除物品和转账时增量更新，查询统计时直接读取计数器，不扫描item表和ledger表。
+ * @note 启动时用两次分组聚合查询建立计数器；数据库回滚过时计数器可能含有未写入的修改，下次查询前重建。
+ * @note 只在写线程上使用。
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QMap>
+
+#include "item.h"
+
+class Database;
+
+/**
+ * @brief 统计数据类
+ */
+class Statistics
+{
+public:
+    /**
+     * @brief 删除默认构造函数
+     */
+    Statistics() = delete;
+
+    /**
+     * @brief 构造函数，从数据库建立计数器
+     * @param _db 数据库的指针
+     */
+    Statistics(Database *_db);
+
+    /**
+     * @brief 记录插入了一个物品
+     * @param state 物品状态
+     * @param expressman 快递员
+     */
+    void itemInserted(int state, const QString &expressman);
+
+    /**
+     * @brief 记录修改了一个物品
+     * @param item 修改前的物品
+     * @param patch 修改的列
+     */
+    void itemModified(const Item &item, const ItemPatch &patch);
+
+    /**
+     * @brief 记录修改了一个物品
+     * @param state 修改前的物品状态
+     * @param expressman 修改前的快递员
+     * @param patch 修改的列
+     */
+    void itemModified(int state, const QString &expressman, const ItemPatch &patch);
+
+    /**
+     * @brief 记录删除了一个物品
+     * @param item 被删除的物品
+     */
+    void itemDeleted(const Item &item);
+
+    /**
+     * @brief 记录一次转账，只统计管理员账户的收支
+     * @param srcName 付款用户的用户名
+     * @param dstName 收款用户的用户名
+     * @param amount 金额
+     * @param time 物流系统时间
+     */
+    void transferred(const QString &srcName, const QString &dstName, int amount, const Time &time);
+
+    /**
+     * @brief 把统计数据写成json
+     * @param ret 用于返回结果
+     */
+    void toJson(QJsonObject &ret) const;
+
+    /**
+     * @brief 从数据库重建计数器
+     * @note 批量导入物品后调用
+     */
+    void rebuild() const;
+
+private:
+    Database *db;                                                 //数据库
+    mutable QHash<int, int> itemsByState;                         //各物流状态的物品数
+    mutable QMap<int, int> revenueByDay;                          //日序号到当天的营收
+    mutable QHash<QString, QHash<int, int>> workloadByExpressman; //快递员(含"未分配")名下各物流状态的物品数
+    mutable int seenRollbackCount;                                //计数器对应的数据库回滚次数
+
+    /**
+     * @brief 改变一组计数
+     * @param state 物流状态
+     * @param expressman 快递员
+     * @param delta 改变量
+     */
+    void count(int state, const QString &expressman, int delta);
+};
+
+#endif
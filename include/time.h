@@ -83,6 +83,37 @@ public:
      * @return false 不是在将来或是今天
      */
     bool isFuture() const;
+
+    /**
+     * @brief 转换为日序号，按物流系统每月31天、每年12个月计，日序号越大时间越晚
+     *
+     * @return int 日序号，年、月、日有未设置(-1)的部分则返回-1
+     */
+    int toDayNumber() const;
+
+    /**
+     * @brief 以已设置的年、月作为范围，返回范围内第一天的日序号
+     *
+     * @return int 日序号，年未设置则返回-1
+     * @note 只有月也设置时才考虑日
+     */
+    int firstDayNumber() const;
+
+    /**
+     * @brief 以已设置的年、月作为范围，返回范围内最后一天的日序号
+     *
+     * @return int 日序号，年未设置则返回-1
+     * @note 只有月也设置时才考虑日
+     */
+    int lastDayNumber() const;
+
+    /**
+     * @brief 由日序号还原时间
+     *
+     * @param dayNumber 日序号，为负数则得到未设置的时间(-1, -1, -1)
+     * @return Time 时间
+     */
+    static Time fromDayNumber(int dayNumber);
 };
 
 #endif
\ No newline at end of file
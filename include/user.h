@@ -22,12 +22,19 @@
 #define DEBUG
 
 #include "database.h"
+#include "dispatcher.h"
+#include "stats.h"
 #include "time.h"
 
+#include <QReadWriteLock>
+
 const int CUSTOMER = 1;
 const int ADMINISTRATOR = 2;
 const int EXPRESSMAN = 3;
 
+const qint64 ONLINE_IMPORT_MAX_BYTES = 1 << 20; //服务器上导入的CSV文件最大字节数，更大的用离线命令行导入
+const int ONLINE_EXPORT_MAX_ROWS = 10000;        //服务器上导出的最大行数，更多的用离线命令行导出
+
 extern const int RECEIVED;          //已签收
 extern const int PENDING_REVEICING; //待签收
 
@@ -129,8 +136,10 @@ public:
     /**
      * @brief 插入用户信息到数据库中
      * @param db 数据库
+     * @return true 插入成功
+     * @return false 插入失败
      */
-    void insertInfo2DB(Database *db);
+    bool insertInfo2DB(Database *db);
 
 protected:
     QString username;    //用户名
@@ -291,7 +300,14 @@ public:
      */
     UserManage() = delete;
 
-    UserManage(Database *_db, ItemManage *_itemManage) : db(_db), itemManage(_itemManage) {}
+    UserManage(Database *_db, ItemManage *_itemManage, Statistics *_stats, Dispatcher *_dispatcher);
+
+    /**
+     * @brief 数据库回滚过则从数据库重新读取已登录用户的信息
+     * @note 转账成功后直接修改了userMap中的余额，所在的请求或这一组写入被撤销后余额要以数据库为准
+     * @note 只在写线程上调用
+     */
+    void checkRollback();
 
     /**
      * @brief 注册普通用户
@@ -340,6 +356,7 @@ public:
      * @param expressman 快递员用户名
      * @return QString 如果删除成功，返回空串，否则返回错误信息.
      * @note 只有EXPRESSMAN支持删除
+     * @note 他名下未揽收的快递退回待分配，再按当前的派单策略重新派给其他快递员
      * @note 只有ADMINISTRATOR有权限删除EXPRESSMAN
      */
     QString deleteExpressman(const QJsonObject &token, const QString &expressman) const;
@@ -417,6 +434,78 @@ public:
      */
     QString addBalance(const QJsonObject &token, int addend) const;
 
+    /**
+     * @brief 查询账目，即与用户有关的所有账本记录
+     * @param token 凭据
+     * @param info 查询条件
+     * @param ret 账本记录数组，按流水号排序
+     * @return QString 查询成功则返回空串，否则返回错误信息
+     *
+     * @note 查询条件格式:
+     * ```json
+     * {
+     *      可选："username" : <字符串> (仅管理员可以查看其他用户的账目)
+     * }
+     * ```
+     * 账本记录格式:
+     * ```json
+     * {
+     *      "id" : <整数>,
+     *      "srcName" : <字符串> (为空表示充值),
+     *      "dstName" : <字符串> (为空表示提现),
+     *      "amount" : <整数>,
+     *      "year" : <整数>,
+     *      "month" : <整数>,
+     *      "day" : <整数>
+     * }
+     * ```
+     */
+    QString queryHistory(const QJsonObject &token, const QJsonObject &info, QJsonArray &ret) const;
+
+    /**
+     * @brief 查询统计数据
+     * @param token 凭据
+     * @param ret 统计数据
+     * @return QString 查询成功则返回空串，否则返回错误信息
+     *
+     * @note 仅管理员可以查询，直接读取增量维护的计数器。统计数据格式:
+     * ```json
+     * {
+     *      "total" : <整数> (物品总数),
+     *      "state" : { <物流状态> : <整数>, ... },
+     *      "revenue" : [ { "year" : <整数>, "month" : <整数>, "day" : <整数>, "amount" : <整数> }, ... ] (按日期排序),
+     *      "workload" : { <快递员> : { <物流状态> : <整数>, ... }, ... }
+     * }
+     * ```
+     */
+    QString queryStats(const QJsonObject &token, QJsonObject &ret) const;
+
+    /**
+     * @brief 从服务器上的CSV文件批量导入物品或用户
+     * @param token 凭据
+     * @param table 导入的表，"item"或"user"
+     * @param fileName 数据目录中的文件路径，相对路径相对于数据目录
+     * @param count 用于返回导入的行数
+     * @return QString 导入成功则返回空串，否则返回错误信息
+     * @note 仅管理员可以导入，文件格式见Database::importItems和Database::importUsers
+     * @note 文件必须在数据目录(配置项server/dataDir，默认为DATA_DIR_NAME)中
+     * @note 导入在服务器线程上同步进行，期间不处理其他请求，只接受不超过ONLINE_IMPORT_MAX_BYTES的文件；
+     *       更大的文件停服后用命令行参数--import-items、--import-users离线导入
+     */
+    QString importData(const QJsonObject &token, const QString &table, const QString &fileName, int &count) const;
+
+    /**
+     * @brief 把物品或用户导出为服务器上的CSV文件
+     * @param token 凭据
+     * @param table 导出的表，"item"或"user"
+     * @param fileName 数据目录中的文件路径，相对路径相对于数据目录
+     * @param count 用于返回导出的行数
+     * @return QString 导出成功则返回空串，否则返回错误信息
+     * @note 仅管理员可以导出，文件必须在数据目录中
+     * @note 只导出不超过ONLINE_EXPORT_MAX_ROWS行的表，更大的表用命令行参数--export-items、--export-users离线导出
+     */
+    QString exportData(const QJsonObject &token, const QString &table, const QString &fileName, int &count) const;
+
     /**
      * @brief 按照条件查询商品，条件以Json给出。
      * @param woken 用户鉴权
@@ -490,8 +579,31 @@ public:
      *      可选："dstName" : <字符串>
      * }
      * ```
+     * 以上各种查询都可以再加上寄送时间的范围(含两端)，只给出年或年、月时按整年或整月计:
+     * ```json
+     * {
+     *      可选："from" : {"year" : <整数>, 可选："month" : <整数>, 可选："day" : <整数>},
+     *      可选："to" : {"year" : <整数>, 可选："month" : <整数>, 可选："day" : <整数>}
+     * }
+     * ```
+     * 以上各种查询都可以分页和排序:
+     * ```json
+     * {
+     *      可选："limit" : <整数> (每页最多几条，1~MAX_ITEM_PAGE_SIZE，不给出则不分页),
+     *      可选："orderBy" : "id" 或 "sendingTime" (默认为"id"),
+     *      可选："cursor" : <字符串> (上一页返回的cursor，原样传回以获取下一页)
+     * }
+     * ```
+     * 以上各种查询都可以再加上描述条件，用描述的倒排索引查找:
+     * ```json
+     * {
+     *      可选："descriptionContains" : <字符串> (描述中包含这段文字，区分大小写)
+     * }
+     * ```
+     * @param cursor 分页时若这一页已满，返回获取下一页用的cursor，否则为空串
+     * @note 可以在工作线程上调用，此时使用数据库的只读连接
      */
-    QString queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret) const;
+    QString queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret, QString &cursor) const;
 
     /**
      * @brief 发送快递物品
@@ -547,10 +659,51 @@ public:
      */
     QString deleteItem(const QJsonObject &token, const int id) const;
 
+    /**
+     * @brief 为一批快递指定同一个快递员
+     * @param token 凭据
+     * @param itemIds 快递物品单号的数组
+     * @param expressman 快递员的用户名
+     * @return QString 成功则返回空串，否则返回错误信息
+     * @note 所有物品用一次查询检查，都可以指派时才在同一个事务中修改，否则一个也不修改
+     */
+    QString assignItems(const QJsonObject &token, const QJsonArray &itemIds, const QString &expressman) const;
+
+    /**
+     * @brief 运送一批快递物品
+     * @param token 凭据
+     * @param itemIds 快递物品单号的数组
+     * @return QString 成功则返回空串，否则返回错误信息
+     * @note 各物品的运费提成合计为一笔转账
+     */
+    QString deliveryItems(const QJsonObject &token, const QJsonArray &itemIds) const;
+
+    /**
+     * @brief 接收一批快递物品
+     * @param token 凭据
+     * @param itemIds 快递物品单号的数组
+     * @return QString 成功则返回空串，否则返回错误信息
+     */
+    QString receiveItems(const QJsonObject &token, const QJsonArray &itemIds) const;
+
 private:
     QMap<QString, QSharedPointer<User>> userMap; //用户名到用户对象的映射.
+    mutable QReadWriteLock userMapLock;          //查询物品在工作线程上读userMap，登录、登出修改userMap时加写锁
     Database *db;                                //数据库
     ItemManage *itemManage;                      //物品管理类
+    Statistics *stats;                           //统计数据
+    Dispatcher *dispatcher;                      //自动派单
+    int seenRollbackCount;                       //userMap对应的数据库回滚次数
+    QString dataDir;                             //数据目录，导入导出的文件只能在其中
+
+    /**
+     * @brief 把导入导出请求中的文件路径解析为数据目录中的路径
+     * @param fileName 请求中的文件路径，相对路径相对于数据目录
+     * @param path 用于返回解析出的绝对路径
+     * @return true 文件在数据目录中
+     * @return false 文件在数据目录之外(含经由..或符号链接)，或数据目录不存在
+     */
+    bool resolveDataFile(const QString &fileName, QString &path) const;
 
     /**
      * @brief 用户鉴权
@@ -560,6 +713,20 @@ private:
      */
     QString verify(const QJsonObject &token) const;
 
+    /**
+     * @brief 解析批量操作的单号数组，并用一次查询取出这些物品
+     * @param itemIds 快递物品单号的数组，重复的单号只算一次
+     * @param items 用于返回物品
+     * @return QString 成功则返回空串，单号有误或有物品不存在时返回错误信息
+     */
+    QString loadItemBatch(const QJsonArray &itemIds, QVector<ItemRow> &items) const;
+
+    /**
+     * @brief 把待分配队列中最早的一批物品派给快递员
+     * @note 每次最多派出MAX_BULK_ITEMS个，每个快递员一次批量修改；队列较长时在之后的寄件请求中继续派出
+     */
+    void dispatchQueued() const;
+
     /**
      * @brief 转钱: 减少一个用户的余额，增加另一个用户的余额。
      * @param token 第一个用户（减去转移余额量的用户）的token
@@ -567,6 +734,7 @@ private:
      * @param srcUser 第二个用户（加上转移余额量的用户）的用户名
      * @return QString 转钱成功，返回空串，否则返回错误信息.
      * @note 转移余额量可以为负
+     * @note 只追加一条账本记录，双方余额在同一个事务中更新
      */
     QString transferBalance(const QJsonObject &token, int balance, const QString &dstUser) const;
 };
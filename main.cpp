@@ -52,11 +52,72 @@ int main(int argc, char * argv[])
 {
     qInstallMessageHandler(messageHandler); // Qt自带的输出详细日志
     QCoreApplication a(argc, argv);
-    Database database("defaultConnection", "../data/users.txt");
-    ItemManage itemManage(&database);
-    UserManage userManage(&database, &itemManage);
-    Server server(&a, 8946, &userManage);
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("columnar-items", "在内存中维护物品的列式副本"));
+    parser.addOption(QCommandLineOption("dispatch", "寄件时自动派单的策略：least-loaded或round-robin", "policy"));
+    //批量导入导出：完成后直接退出，不启动服务器
+    QStringList bulkOptions{"import-items", "export-items", "import-users", "export-users"};
+    for (const QString &option : bulkOptions)
+        parser.addOption(QCommandLineOption(option, "批量导入或导出CSV文件", "file"));
+    parser.process(a);
+
+    bool columnarItems = parser.isSet("columnar-items"); //加上--columnar-items参数时在内存中维护物品的列式副本
+    int dispatchPolicy = DISPATCH_MANUAL;                 //加上--dispatch参数时寄件自动派单，否则由管理员指派
+    if (parser.value("dispatch") == "least-loaded")
+        dispatchPolicy = DISPATCH_LEAST_LOADED;
+    else if (parser.value("dispatch") == "round-robin")
+        dispatchPolicy = DISPATCH_ROUND_ROBIN;
+    else if (parser.isSet("dispatch"))
+    {
+        qCritical() << "未知的派单策略" << parser.value("dispatch");
+        return 1;
+    }
+    QElapsedTimer startupTimer, phaseTimer; //统计启动总耗时和各阶段的耗时
+    startupTimer.start();
+    phaseTimer.start();
+    Database database("defaultConnection", "../data/users.txt", columnarItems);
+    qInfo() << "启动:数据库初始化耗时" << phaseTimer.restart() << "ms";
+
+    bool bulk = false; //是否做了批量导入导出
+    for (const QString &option : bulkOptions)
+    {
+        if (!parser.isSet(option))
+            continue;
+        bulk = true;
+        QFile file(parser.value(option));
+        if (!file.open(option.startsWith("import") ? QIODevice::ReadOnly | QIODevice::Text : QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        {
+            qCritical() << "无法打开文件" << file.fileName();
+            return 1;
+        }
+        QTextStream stream(&file);
+        stream.setCodec("UTF-8");
+        int count;
+        if (option == "import-items")
+            count = database.importItems(stream);
+        else if (option == "export-items")
+            count = database.exportItems(stream);
+        else if (option == "import-users")
+            count = database.importUsers(stream);
+        else
+            count = database.exportUsers(stream);
+        stream.flush();
+        if (count == -1)
+            return 1;
+        qInfo() << option << "完成，共" << count << "行，耗时" << phaseTimer.restart() << "ms";
+    }
+    if (bulk)
+        return 0;
+    Statistics statistics(&database);
+    Dispatcher dispatcher(&database, dispatchPolicy);
+    ItemManage itemManage(&database, &statistics, &dispatcher);
+    UserManage userManage(&database, &itemManage, &statistics, &dispatcher);
+    qInfo() << "启动:物品管理初始化耗时" << phaseTimer.restart() << "ms";
+    Server server(&a, 8946, &userManage, &database);
+    qInfo() << "启动:绑定端口耗时" << phaseTimer.restart() << "ms";
     Time::init();
+    qInfo() << "启动完成，总耗时" << startupTimer.elapsed() << "ms";
 
     return a.exec();
 }
\ No newline at end of file
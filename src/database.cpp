@@ -12,6 +12,13 @@
 #include "../include/database.h"
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
 
 using namespace std;
 
@@ -23,39 +30,524 @@ void Database::exec(const QSqlQuery &sqlQuery)
         qDebug() << i.key().toUtf8().data() << ":" << i.value().toString().toUtf8().data();
 }
 
+QSqlQuery Database::preparedQuery(const QString &queryString) const
+{
+    auto i = preparedQueries.constFind(queryString);
+    if (i != preparedQueries.constEnd())
+        return i.value();
+
+    QSqlQuery sqlQuery(db);
+    if (!sqlQuery.prepare(queryString))
+        qCritical() << "数据库:预编译SQL语句失败" << queryString << sqlQuery.lastError();
+    else
+        preparedQueries.insert(queryString, sqlQuery);
+    return sqlQuery;
+}
+
+QSqlQuery Database::preparedItemFilterQuery(int filterMask) const
+{
+    QHash<int, QSqlQuery> *queries = &itemFilterQueries;
+    QSqlDatabase connection = db;
+    if (QThread::currentThread() != writerThread)
+    {
+        ReadConnection *reader = readConnection();
+        queries = &reader->itemFilterQueries;
+        connection = reader->db;
+    }
+
+    auto i = queries->constFind(filterMask);
+    if (i != queries->constEnd())
+        return i.value();
+
+    QString queryString = itemFilterQueryString(filterMask);
+    QSqlQuery sqlQuery(connection);
+    if (!sqlQuery.prepare(queryString))
+        qCritical() << "数据库:预编译SQL语句失败" << queryString << sqlQuery.lastError();
+    else
+        queries->insert(filterMask, sqlQuery);
+    return sqlQuery;
+}
+
+Database::ReadConnection::~ReadConnection()
+{
+    QString connectionName = db.connectionName();
+    itemFilterQueries.clear();
+    db.close();
+    db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+namespace
+{
+    /**
+     * @brief 读取取值为关键字的配置项
+     * @param allowed 允许的关键字(大写)
+     * @return QString 大写的关键字，不在allowed中则返回默认值
+     */
+    QString keywordSetting(const QSettings &settings, const QString &key, const QString &defaultValue, const QStringList &allowed)
+    {
+        QString value = settings.value(key, defaultValue).toString().trimmed().toUpper();
+        if (allowed.contains(value))
+            return value;
+        qWarning() << "数据库:配置项" << key << "的值" << value << "无效，使用默认值" << defaultValue;
+        return defaultValue;
+    }
+
+    /**
+     * @brief 读取取值为整数的配置项
+     * @return qint64 配置的整数，不是整数或超出[minValue, maxValue]则返回默认值
+     */
+    qint64 numberSetting(const QSettings &settings, const QString &key, qint64 defaultValue, qint64 minValue, qint64 maxValue)
+    {
+        bool ok;
+        QString text = settings.value(key, defaultValue).toString().trimmed();
+        qint64 value = text.toLongLong(&ok);
+        if (ok && value >= minValue && value <= maxValue)
+            return value;
+        qWarning() << "数据库:配置项" << key << "的值" << text << "无效，使用默认值" << defaultValue;
+        return defaultValue;
+    }
+}
+
+void Database::configure()
+{
+    //PRAGMA语句中不能绑定参数，只拼接固定的PRAGMA名和校验过的值
+    QSettings settings(SETTINGS_FILE_NAME, QSettings::IniFormat);
+    settings.beginGroup("database");
+    //组提交回复客户端前要求这一组已经落盘：不接受OFF、MEMORY日志和低于FULL的synchronous，WAL下NORMAL掉电时会丢掉已提交的组
+    QString journalMode = keywordSetting(settings, "journalMode", "WAL", {"DELETE", "TRUNCATE", "PERSIST", "WAL"});
+    connectionPragmas.append("PRAGMA synchronous = " + keywordSetting(settings, "synchronous", "FULL", {"FULL", "EXTRA", "2", "3"}));
+    connectionPragmas.append("PRAGMA mmap_size = " + QString::number(numberSetting(settings, "mmapSize", 268435456, 0, std::numeric_limits<qint64>::max())));
+    connectionPragmas.append("PRAGMA cache_size = " + QString::number(numberSetting(settings, "cacheSize", -16384, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()))); //负数表示KiB
+    settings.endGroup();
+
+    //日志模式保存在数据库文件中，只需在写连接上设置一次
+    QSqlQuery sqlQuery(db);
+    if (!sqlQuery.exec("PRAGMA journal_mode = " + journalMode) || !sqlQuery.next())
+        qCritical() << "数据库:设置日志模式失败" << sqlQuery.lastError();
+    else if (sqlQuery.value(0).toString().toUpper() != journalMode)
+        qCritical() << "数据库:日志模式设置为" << journalMode << "失败，实际为" << sqlQuery.value(0).toString();
+    else
+        qDebug() << "数据库:日志模式为" << sqlQuery.value(0).toString();
+    sqlQuery.finish();
+    for (const QString &pragma : connectionPragmas)
+        if (!sqlQuery.exec(pragma))
+            qCritical() << "数据库:" << pragma << "失败" << sqlQuery.lastError();
+}
+
+Database::ReadConnection *Database::readConnection() const
+{
+    if (readConnections.hasLocalData())
+        return readConnections.localData();
+
+    ReadConnection *reader = new ReadConnection;
+    reader->db = QSqlDatabase::addDatabase("QSQLITE", "readConnection" + QString::number(readConnectionCount.fetchAndAddRelaxed(1)));
+    reader->db.setDatabaseName(DATABASE_FILE_NAME);
+    if (!reader->db.open())
+        qCritical() << "数据库:打开只读连接失败" << reader->db.lastError();
+    QSqlQuery sqlQuery(reader->db);
+    sqlQuery.exec("PRAGMA query_only = ON");
+    for (const QString &pragma : connectionPragmas)
+        sqlQuery.exec(pragma);
+    readConnections.setLocalData(reader);
+    qDebug() << "数据库:打开只读连接" << reader->db.connectionName();
+    return reader;
+}
+
+namespace
+{
+    /**
+     * @brief 生成IN列表的占位符
+     * @param n 单号个数
+     * @return QString 形如":id0, :id1, :id2"
+     */
+    QString idPlaceholders(int n)
+    {
+        QStringList placeholders;
+        for (int i = 0; i < n; i++)
+            placeholders.append(":id" + QString::number(i));
+        return placeholders.join(", ");
+    }
+
+    /**
+     * @brief 为一个日序号列生成年、月、日的查询条件
+     * @param conditions 用于返回查询条件
+     * @param column 日序号列名
+     * @param hasYear 是否按年查询
+     * @param hasMonth 是否按月查询
+     * @param hasDay 是否按日查询
+     * @note 给出年时按日序号的范围查询，可以用上索引；没给出年时只能逐行计算月、日
+     */
+    void appendDayConditions(QStringList &conditions, const QString &column, bool hasYear, bool hasMonth, bool hasDay)
+    {
+        if (hasYear)
+            conditions.append(column + " BETWEEN :" + column + "_First AND :" + column + "_Last");
+        else if (hasMonth)
+            conditions.append(column + " >= 0 AND " + column + " % 372 / 31 + 1 = :" + column + "_Month");
+        if (hasDay && !(hasYear && hasMonth))
+            conditions.append(column + " >= 0 AND " + column + " % 31 + 1 = :" + column + "_Day");
+    }
+
+    /**
+     * @brief 绑定appendDayConditions生成的查询条件的参数
+     * @param sqlQuery 查询语句
+     * @param column 日序号列名
+     * @param time 要查询的时间，未设置的部分为-1
+     */
+    void bindDayConditions(QSqlQuery &sqlQuery, const QString &column, const Time &time)
+    {
+        if (time.year != -1)
+        {
+            sqlQuery.bindValue(":" + column + "_First", time.firstDayNumber());
+            sqlQuery.bindValue(":" + column + "_Last", time.lastDayNumber());
+        }
+        else if (time.month != -1)
+            sqlQuery.bindValue(":" + column + "_Month", time.month);
+        if (time.day != -1 && !(time.year != -1 && time.month != -1))
+            sqlQuery.bindValue(":" + column + "_Day", time.day);
+    }
+
+    /**
+     * @brief 把物品描述切分为描述索引的词项：每个字符(一元)和每两个相邻字符(二元)，去重
+     * @param description 物品描述
+     * @return QStringList 词项
+     */
+    QStringList descriptionGrams(const QString &description)
+    {
+        QSet<QString> grams;
+        for (int i = 0; i < description.size(); i++)
+        {
+            grams.insert(description.mid(i, 1));
+            if (i + 1 < description.size())
+                grams.insert(description.mid(i, 2));
+        }
+        return grams.values();
+    }
+
+    /**
+     * @brief 把一个字段转换为CSV格式，含逗号、引号或换行时加引号
+     * @param field 字段
+     * @return QString CSV字段
+     */
+    QString csvField(const QString &field)
+    {
+        if (!field.contains(',') && !field.contains('"') && !field.contains('\n') && !field.contains('\r'))
+            return field;
+        QString quoted(field);
+        quoted.replace("\"", "\"\"");
+        return "\"" + quoted + "\"";
+    }
+
+    /**
+     * @brief 读取一条CSV记录，引号中的换行属于字段内容
+     * @param in 输入流
+     * @param fields 用于返回各字段
+     * @return true 读到一条记录
+     * @return false 已到文件末尾
+     */
+    bool readCsvRecord(QTextStream &in, QStringList &fields)
+    {
+        fields.clear();
+        if (in.atEnd())
+            return false;
+        QString line = in.readLine();
+        while (line.count('"') % 2 && !in.atEnd())
+            line += "\n" + in.readLine();
+
+        QString field;
+        bool quoted = false;
+        for (int i = 0; i < line.size(); i++)
+        {
+            QChar c = line[i];
+            if (quoted)
+            {
+                if (c != '"')
+                    field += c;
+                else if (i + 1 < line.size() && line[i + 1] == '"')
+                    field += line[++i];
+                else
+                    quoted = false;
+            }
+            else if (c == '"')
+                quoted = true;
+            else if (c == ',')
+            {
+                fields.append(field);
+                field.clear();
+            }
+            else
+                field += c;
+        }
+        fields.append(field);
+        return true;
+    }
+
+    /**
+     * @brief 把时间转换为CSV字段，格式为"年-月-日"，未设置的时间为空
+     * @param time 时间
+     * @return QString CSV字段
+     */
+    QString csvTime(const Time &time)
+    {
+        if (time.year == -1)
+            return {};
+        return QString::number(time.year) + "-" + QString::number(time.month) + "-" + QString::number(time.day);
+    }
+
+    /**
+     * @brief 解析csvTime生成的时间
+     * @param field CSV字段
+     * @param time 用于返回时间
+     * @return true 解析成功
+     * @return false 格式有误
+     */
+    bool parseCsvTime(const QString &field, Time &time)
+    {
+        if (field.isEmpty())
+        {
+            time = Time(-1, -1, -1);
+            return true;
+        }
+        QStringList parts = field.split('-');
+        if (parts.size() != 3)
+            return false;
+        bool okYear, okMonth, okDay;
+        time = Time(parts[0].toInt(&okYear), parts[1].toInt(&okMonth), parts[2].toInt(&okDay));
+        return okYear && okMonth && okDay && time.month >= 1 && time.month <= 12 && time.day >= 1 && time.day <= 31;
+    }
+
+    /**
+     * @brief 解析一条物品记录中的数值字段
+     * @return true 解析成功
+     * @return false 字段数、数值或时间格式有误
+     */
+    bool parseItemRecord(const QStringList &fields, int &id, int &cost, int &type, int &state, Time &sendingTime, Time &receivingTime)
+    {
+        bool okId, okCost, okType, okState;
+        id = fields.value(0).toInt(&okId), cost = fields.value(1).toInt(&okCost);
+        type = fields.value(2).toInt(&okType), state = fields.value(3).toInt(&okState);
+        return fields.size() == 10 && okId && okCost && okType && type >= FRAGILE && type <= NORMAL && okState && state >= PENDING_COLLECTING && state <= RECEIVED &&
+               parseCsvTime(fields[4], sendingTime) && parseCsvTime(fields[5], receivingTime);
+    }
+
+    /**
+     * @brief 解析一条用户记录中的数值字段
+     * @return true 解析成功
+     * @return false 字段数、用户名、类型或余额有误
+     */
+    bool parseUserRecord(const QStringList &fields, int &type, int &balance)
+    {
+        bool okType, okBalance;
+        type = fields.value(2).toInt(&okType), balance = fields.value(3).toInt(&okBalance);
+        return fields.size() == 7 && !fields[0].isEmpty() && okType && type >= CUSTOMER && type <= EXPRESSMAN && okBalance && balance >= 0;
+    }
+}
+
+QString Database::itemFilterQueryString(int filterMask)
+{
+    QStringList conditions;
+    if (filterMask & ITEM_FILTER_ID)
+        conditions.append("id = :id");
+    if (filterMask & ITEM_FILTER_STATE)
+        conditions.append("state = :state");
+    appendDayConditions(conditions, "sendingDay", filterMask & ITEM_FILTER_SENDING_YEAR, filterMask & ITEM_FILTER_SENDING_MONTH, filterMask & ITEM_FILTER_SENDING_DAY);
+    appendDayConditions(conditions, "receivingDay", filterMask & ITEM_FILTER_RECEIVING_YEAR, filterMask & ITEM_FILTER_RECEIVING_MONTH, filterMask & ITEM_FILTER_RECEIVING_DAY);
+    if (filterMask & ITEM_FILTER_SENDING_FROM)
+        conditions.append("sendingDay >= :sendingFrom");
+    if (filterMask & ITEM_FILTER_SENDING_TO)
+        conditions.append("sendingDay <= :sendingTo");
+    if (filterMask & ITEM_FILTER_SRC_NAME)
+        conditions.append("srcName = :srcName");
+    if (filterMask & ITEM_FILTER_DST_NAME)
+        conditions.append("dstName = :dstName");
+    if (filterMask & ITEM_FILTER_EXPRESSMAN)
+        conditions.append("expressman = :expressman");
+    if (filterMask & ITEM_FILTER_DESCRIPTION) //用首尾两个词项的倒排表求交得到候选，再逐个确认
+        conditions.append("id IN (SELECT id FROM item_gram WHERE gram = :firstGram INTERSECT SELECT id FROM item_gram WHERE gram = :lastGram)"
+                          " AND instr(description, :description) > 0");
+    bool bySendingTime = filterMask & ITEM_FILTER_ORDER_SENDING_TIME;
+    if (filterMask & ITEM_FILTER_AFTER)
+        conditions.append(bySendingTime ? "(sendingDay, id) > (:afterKey, :afterId)" : "id > :afterId");
+
+    QString queryString(filterMask & ITEM_FILTER_ARCHIVE ? "SELECT * FROM item_archive" : "SELECT * FROM item");
+    if (!conditions.isEmpty())
+        queryString += " WHERE " + conditions.join(" AND ");
+    queryString += bySendingTime ? " ORDER BY sendingDay, id" : " ORDER BY id";
+    if (filterMask & ITEM_FILTER_LIMIT)
+        queryString += " LIMIT :limit";
+    return queryString;
+}
+
+QString Database::itemTableDefinition(const QString &tableName)
+{
+    return "CREATE TABLE " + tableName + "( id INT PRIMARY KEY NOT NULL,"
+                                         "cost INT NOT NULL,"
+                                         "type INT NOT NULL,"
+                                         "state INT NOT NULL,"
+                                         "sendingDay INT NOT NULL,"
+                                         "receivingDay INT NOT NULL,"
+                                         "srcName TEXT NOT NULL,"
+                                         "dstName TEXT NOT NULL,"
+                                         "expressman TEXT NOT NULL,"
+                                         "description TEXT NOT NULL) ";
+}
+
+void Database::migrateItemTable()
+{
+    //在新表中写好再替换旧表，迁移失败时旧表保持不变
+    QSqlQuery sqlQuery(db);
+    db.transaction();
+    bool ok = sqlQuery.exec(itemTableDefinition("item_new")) &&
+              sqlQuery.exec("INSERT INTO item_new SELECT id, cost, type, state,"
+                            " CASE WHEN sendingTime_Year < 0 OR sendingTime_Month < 0 OR sendingTime_Day < 0 THEN -1"
+                            " ELSE sendingTime_Year * 372 + (sendingTime_Month - 1) * 31 + sendingTime_Day - 1 END,"
+                            " CASE WHEN receivingTime_Year < 0 OR receivingTime_Month < 0 OR receivingTime_Day < 0 THEN -1"
+                            " ELSE receivingTime_Year * 372 + (receivingTime_Month - 1) * 31 + receivingTime_Day - 1 END,"
+                            " srcName, dstName, expressman, description FROM item") &&
+              sqlQuery.exec("DROP TABLE item") &&
+              sqlQuery.exec("ALTER TABLE item_new RENAME TO item");
+    if (!ok || !db.commit())
+    {
+        qCritical() << "item表迁移失败" << sqlQuery.lastError();
+        db.rollback();
+        exit(1);
+    }
+    qDebug() << "item表迁移为日序号列成功";
+}
+
+void Database::createItemIndexes(const QString &tableName)
+{
+    //(用户名, 物流状态)索引同时覆盖只按用户名和按用户名加状态的查询
+    //(用户名, 寄送日序号)索引使按寄送时间分页时不用排序
+    //单号不是rowid的别名，二级索引末尾自带的是rowid而不是单号，所以每个索引都显式以单号结尾，按单号排序和分页时不用排序
+    static const char *const indexes[][2] = {{"_srcName_state", "srcName, state, id"},
+                                             {"_dstName_state", "dstName, state, id"},
+                                             {"_expressman_state", "expressman, state, id"},
+                                             {"_state", "state, id"},
+                                             {"_sendingDay", "sendingDay, id"},
+                                             {"_srcName_sendingDay", "srcName, sendingDay, id"},
+                                             {"_dstName_sendingDay", "dstName, sendingDay, id"},
+                                             {"_expressman_sendingDay", "expressman, sendingDay, id"}};
+
+    QSqlQuery sqlQuery(db);
+    QStringList existing;
+    sqlQuery.exec("SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = '" + tableName + "'");
+    while (sqlQuery.next())
+        existing.append(sqlQuery.value(0).toString());
+
+    int created = 0;
+    for (const auto &index : indexes)
+    {
+        QString indexName = tableName + index[0];
+        if (existing.contains(indexName))
+            continue;
+        //已有数据库在启动时补建索引，建索引期间只阻塞写入
+        if (!sqlQuery.exec("CREATE INDEX IF NOT EXISTS " + indexName + " ON " + tableName + "(" + index[1] + ")"))
+            qCritical() << "数据库:创建索引" << indexName << "失败" << sqlQuery.lastError();
+        else
+        {
+            qDebug() << "数据库:创建索引" << indexName << "成功";
+            created++;
+        }
+    }
+    if (created) //更新统计信息，让查询优化器选用新索引
+        sqlQuery.exec("ANALYZE " + tableName);
+}
+
+bool Database::checkItemIndexes() const
+{
+    //与UserManage::queryItem的几种查询一一对应，每种查询要用上的索引(用|隔开的任意一个)
+    //分页查询还要求按索引顺序读取，不能先取出全部结果再排序
+    static const struct
+    {
+        int filterMask;
+        const char *indexes;
+        bool ordered;
+    } expectedPlans[] = {{ITEM_FILTER_STATE, "item_state", false},
+                         {ITEM_FILTER_SRC_NAME, "item_srcName_state|item_srcName_sendingDay", false},
+                         {ITEM_FILTER_SRC_NAME | ITEM_FILTER_STATE, "item_srcName_state", false},
+                         {ITEM_FILTER_DST_NAME, "item_dstName_state|item_dstName_sendingDay", false},
+                         {ITEM_FILTER_DST_NAME | ITEM_FILTER_STATE, "item_dstName_state", false},
+                         {ITEM_FILTER_EXPRESSMAN, "item_expressman_state|item_expressman_sendingDay", false},
+                         {ITEM_FILTER_EXPRESSMAN | ITEM_FILTER_STATE, "item_expressman_state", false},
+                         {ITEM_FILTER_SENDING_FROM | ITEM_FILTER_SENDING_TO, "item_sendingDay", false},
+                         {ITEM_FILTER_SENDING_YEAR | ITEM_FILTER_SENDING_MONTH, "item_sendingDay", false},
+                         {ITEM_FILTER_AFTER | ITEM_FILTER_LIMIT, "sqlite_autoindex_item_1", true},
+                         {ITEM_FILTER_AFTER | ITEM_FILTER_LIMIT | ITEM_FILTER_ORDER_SENDING_TIME, "item_sendingDay", true},
+                         {ITEM_FILTER_SRC_NAME | ITEM_FILTER_AFTER | ITEM_FILTER_LIMIT | ITEM_FILTER_ORDER_SENDING_TIME, "item_srcName_sendingDay", true},
+                         {ITEM_FILTER_DST_NAME | ITEM_FILTER_AFTER | ITEM_FILTER_LIMIT | ITEM_FILTER_ORDER_SENDING_TIME, "item_dstName_sendingDay", true},
+                         {ITEM_FILTER_EXPRESSMAN | ITEM_FILTER_AFTER | ITEM_FILTER_LIMIT | ITEM_FILTER_ORDER_SENDING_TIME, "item_expressman_sendingDay", true}};
+
+    bool allOk = true;
+    QSqlQuery sqlQuery(db);
+    for (const auto &expected : expectedPlans)
+    {
+        QString queryString = itemFilterQueryString(expected.filterMask);
+        if (!sqlQuery.exec("EXPLAIN QUERY PLAN " + queryString))
+        {
+            qCritical() << "数据库:获取查询计划失败" << queryString << sqlQuery.lastError();
+            allOk = false;
+            continue;
+        }
+        //计划中的每一步：要有一步按预期的索引SEARCH，不能有全表或全索引的SCAN；"SCAN ... USING INDEX"只是按索引顺序扫描，不算用上索引
+        QStringList steps;
+        while (sqlQuery.next())
+            steps.append(sqlQuery.value(3).toString());
+        sqlQuery.finish();
+        bool searched = false, scanned = false, sorted = false;
+        for (const QString &step : steps)
+        {
+            if (step.startsWith("SCAN"))
+                scanned = true;
+            else if (step.contains("TEMP B-TREE"))
+                sorted = true;
+            else if (step.startsWith("SEARCH"))
+                for (const QString &index : QString(expected.indexes).split('|'))
+                    if (step.contains("INDEX " + index + " ("))
+                        searched = true;
+        }
+
+        QString plan = steps.join(";");
+        if (!searched || scanned)
+        {
+            qCritical() << "数据库:查询没有按索引" << expected.indexes << "查找" << queryString << plan;
+            allOk = false;
+        }
+        else if (expected.ordered && sorted)
+        {
+            qCritical() << "数据库:分页查询需要排序" << queryString << plan;
+            allOk = false;
+        }
+        else
+            qDebug() << "数据库:查询计划" << queryString << plan;
+    }
+    return allOk;
+}
+
 const QString &Database::getPrimaryKeyByTableName(const QString &tableName)
 {
-    // static QString username("username");
+    static QString username("username");
     static QString id("id");
-    // if (tableName == "user")
-    //     return username;
-    // else
-    return id;
+    if (tableName == "user")
+        return username;
+    else
+        return id;
 }
 
-Database::Database(const QString &connectionName, const QString &fileName) : userFileName(fileName), usernameSet()
+Database::Database(const QString &connectionName, const QString &fileName, bool columnarItems) : userFileName(fileName), groupCommitting(false), writerThread(QThread::currentThread()), pendingItemsFailed(false), requestAborted(false), requestChanges(0), requestColumnMark(0), rollbackCount(0), archivedUntil(-1)
 {
+    QElapsedTimer phaseTimer; //统计启动各阶段的耗时
+    phaseTimer.start();
+
     db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
-    db.setDatabaseName("../data/db.sqlite");
+    db.setDatabaseName(DATABASE_FILE_NAME);
     db.open();
+    configure();
 
     if (!db.tables().contains("item")) //若不包含item，则创建。
     {
         QSqlQuery sqlQuery(db);
-        sqlQuery.prepare("CREATE TABLE item( id INT PRIMARY KEY NOT NULL,"
-                         "cost INT NOT NULL,"
-                         "type INT NOT NULL,"
-                         "state INT NOT NULL,"
-                         "sendingTime_Year INT NOT NULL,"
-                         "sendingTime_Month INT NOT NULL,"
-                         "sendingTime_Day INT NOT NULL,"
-                         "receivingTime_Year INT NOT NULL,"
-                         "receivingTime_Month INT NOT NULL,"
-                         "receivingTime_Day INT NOT NULL,"
-                         "srcName TEXT NOT NULL,"
-                         "dstName TEXT NOT NULL,"
-                         "expressman TEXT NOT NULL,"
-                         "description TEXT NOT NULL) ");
+        sqlQuery.prepare(itemTableDefinition("item"));
 
         exec(sqlQuery);
         if (!sqlQuery.exec())
@@ -63,43 +555,416 @@ Database::Database(const QString &connectionName, const QString &fileName) : use
         else
             qDebug() << "item表创建成功";
     }
+    else if (db.record("item").contains("sendingTime_Year")) //旧版item表按年、月、日分列存储时间，迁移为日序号列
+        migrateItemTable();
     else
         qDebug() << "item表已存在";
+    if (!db.tables().contains("item_archive")) //已签收的旧物品归档到item_archive
+    {
+        QSqlQuery sqlQuery(db);
+        if (!sqlQuery.exec(itemTableDefinition("item_archive")))
+            qCritical() << "item_archive表创建失败" << sqlQuery.lastError();
+        else
+            qDebug() << "item_archive表创建成功";
+    }
+    if (!db.tables().contains("item_gram")) //物品描述的倒排索引
+        createDescriptionIndex();
+    createItemIndexes("item");
+    createItemIndexes("item_archive");
+    if (!checkItemIndexes())
+        qCritical() << "数据库:item表的查询计划与预期不符，相应的查询会退化为全表扫描或排序";
+    {
+        QSqlQuery sqlQuery(db);
+        if (sqlQuery.exec("SELECT MAX(receivingDay) FROM item_archive") && sqlQuery.next() && !sqlQuery.value(0).isNull())
+            archivedUntil = sqlQuery.value(0).toInt();
+    }
+    qInfo() << "启动:打开数据库耗时" << phaseTimer.restart() << "ms";
+
+    if (columnarItems)
+    {
+        itemColumns.reset(new ColumnItemStore);
+        loadItemColumns();
+        qInfo() << "启动:载入列式副本耗时" << phaseTimer.restart() << "ms";
+    }
+
+    if (!db.tables().contains("user")) //若不包含user，则创建并导入旧版用户文件。
+    {
+        //建表和导入在同一个事务中，导入失败时连表一起撤销，下次启动重新导入
+        db.transaction();
+        QSqlQuery sqlQuery(db);
+        sqlQuery.prepare("CREATE TABLE user( username TEXT PRIMARY KEY NOT NULL,"
+                         "password TEXT NOT NULL,"
+                         "type INT NOT NULL,"
+                         "balance INT NOT NULL,"
+                         "name TEXT NOT NULL,"
+                         "phoneNumber TEXT NOT NULL,"
+                         "address TEXT NOT NULL) ");
+
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "user表创建失败" << sqlQuery.lastError();
+            db.rollback();
+            exit(1);
+        }
+        qDebug() << "user表创建成功";
+        if (!importUserFile() || !db.commit())
+        {
+            qCritical() << "数据库:导入旧版用户文件失败，已撤销user表" << db.lastError();
+            db.rollback();
+            exit(1);
+        }
+        renameImportedUserFile();
+    }
+    else
+        qDebug() << "user表已存在";
+    qInfo() << "启动:加载user表耗时" << phaseTimer.restart() << "ms";
+
+    if (!db.tables().contains("ledger")) //若不包含ledger，则创建。
+        createLedger();
+    else
+        qDebug() << "ledger表已存在";
+    qInfo() << "启动:加载账本耗时" << phaseTimer.restart() << "ms";
+
+    if (!queryUserByName("admin"))
+        insertUser("admin", "123", ADMINISTRATOR, 0, "管理员", "88888888", "环宇物流大厦");
+}
+
+bool Database::importUserFile()
+{
+    if (!QFile::exists(userFileName))
+        return true;
+
+    QHash<QString, UserRecord> users;
+    loadUserSnapshot(users);
+    replayUserLog(users);
+
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("INSERT INTO user VALUES(:username, :password, :type, :balance, :name, :phoneNumber, :address)");
+    for (auto i = users.constBegin(); i != users.constEnd(); i++)
+    {
+        const UserRecord &record = i.value();
+        sqlQuery.bindValue(":username", i.key());
+        sqlQuery.bindValue(":password", record.password);
+        sqlQuery.bindValue(":type", record.type);
+        sqlQuery.bindValue(":balance", record.balance);
+        sqlQuery.bindValue(":name", record.name);
+        sqlQuery.bindValue(":phoneNumber", record.phoneNumber);
+        sqlQuery.bindValue(":address", record.address);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:导入user " << i.key() << " 失败" << sqlQuery.lastError();
+            return false;
+        }
+    }
+    qDebug() << "数据库:从旧版用户文件导入user成功，共" << users.size() << "个用户";
+    return true;
+}
+
+void Database::renameImportedUserFile() const
+{
+    QDir dir;
+    for (const QString &name : {userFileName, userFileName + ".log"})
+    {
+        if (!QFile::exists(name))
+            continue;
+        if (QFile::exists(name + ".imported")) //上一次导入留下的
+            QFile::remove(name + ".imported");
+        if (!dir.rename(name, name + ".imported"))
+            qCritical() << "数据库:重命名" << name << "失败，已导入user表，请手动删除该文件";
+    }
+}
+
+void Database::beginGroupCommit()
+{
+    if (groupCommitting)
+        return;
+    if (!db.transaction())
+        qCritical() << "数据库:开始组提交失败" << db.lastError();
+    else
+        groupCommitting = true;
+}
+
+void Database::beginRequest()
+{
+    if (!groupCommitting)
+        return;
+    QSqlQuery sqlQuery(db);
+    if (!sqlQuery.exec("SELECT total_changes()") || !sqlQuery.next())
+        qCritical() << "数据库:读取修改行数失败" << sqlQuery.lastError();
+    requestChanges = sqlQuery.value(0).toInt();
+    requestColumnMark = itemColumns ? itemColumns->pendingCount() : 0;
+    requestAborted = false;
+    if (!sqlQuery.exec("SAVEPOINT request"))
+        qCritical() << "数据库:创建请求保存点失败" << sqlQuery.lastError();
+}
+
+bool Database::endRequest(bool &wrote)
+{
+    wrote = false;
+    if (!groupCommitting)
+        return true;
+    bool aborted = requestAborted;
+    requestAborted = false;
+    if (aborted) //攒下的物品不再插入
+    {
+        pendingItems.clear();
+        pendingGrams.clear();
+        pendingGramIds.clear();
+    }
+    bool ok = flushPendingItems() && !pendingItemsFailed;
+    pendingItemsFailed = false;
+
+    QSqlQuery sqlQuery(db);
+    wrote = !aborted && (!sqlQuery.exec("SELECT total_changes()") || !sqlQuery.next() || sqlQuery.value(0).toInt() != requestChanges);
+    sqlQuery.finish();
+    if (!ok || aborted)
+    {
+        if (aborted)
+            qDebug() << "数据库:请求要求撤销，撤销这个请求";
+        else
+            qCritical() << "数据库:请求中的写入失败，撤销这个请求";
+        if (!sqlQuery.exec("ROLLBACK TO request"))
+            qCritical() << "数据库:回滚到请求保存点失败" << sqlQuery.lastError();
+        if (itemColumns)
+            itemColumns->rollbackTo(requestColumnMark);
+        rollbackCount++;
+    }
+    if (!sqlQuery.exec("RELEASE request"))
+        qCritical() << "数据库:释放请求保存点失败" << sqlQuery.lastError();
+    return ok;
+}
+
+bool Database::abortRequest()
+{
+    if (!groupCommitting)
+    {
+        qCritical() << "数据库:不在一组写入中，无法撤销这个请求已经做的写入";
+        return false;
+    }
+    requestAborted = true;
+    return true;
+}
+
+bool Database::commitGroupCommit()
+{
+    if (!groupCommitting)
+        return true;
+    groupCommitting = false;
+
+    bool itemsFailed = !flushPendingItems() || pendingItemsFailed;
+    pendingItemsFailed = false;
+    if (itemsFailed || !db.commit())
+    {
+        qCritical() << "数据库:组提交失败" << db.lastError();
+        groupCommitting = true;
+        rollbackGroupCommit();
+        return false;
+    }
+    if (itemColumns)
+        itemColumns->commit();
+    return true;
+}
 
+void Database::loadItemColumns()
+{
+    QSqlQuery sqlQuery(db);
+    sqlQuery.setForwardOnly(true);
+    if (!sqlQuery.exec("SELECT * FROM item UNION ALL SELECT * FROM item_archive ORDER BY id"))
+    {
+        qCritical() << "数据库:载入列式副本失败" << sqlQuery.lastError();
+        return;
+    }
+    while (sqlQuery.next())
+        itemColumns->insert(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toInt(), sqlQuery.value(5).toInt(),
+                            sqlQuery.value(6).toString(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString());
+    sqlQuery.finish();
+    itemColumns->commit();
+    qDebug() << "数据库:列式副本载入" << itemColumns->size() << "个物品";
+}
+
+void Database::commitItemColumns() const
+{
+    if (itemColumns && !groupCommitting)
+        itemColumns->commit();
+}
+
+void Database::rollbackGroupCommit()
+{
+    if (!groupCommitting)
+        return;
+    groupCommitting = false;
+    pendingItems.clear();
+    pendingGrams.clear();
+    pendingGramIds.clear();
+    pendingItemsFailed = false;
+    db.rollback();
+    rollbackCount++;
+    if (itemColumns)
+        itemColumns->rollback();
+}
+
+void Database::createLedger()
+{
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("CREATE TABLE ledger( id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                     "srcName TEXT NOT NULL,"
+                     "dstName TEXT NOT NULL,"
+                     "amount INT NOT NULL,"
+                     "year INT NOT NULL,"
+                     "month INT NOT NULL,"
+                     "day INT NOT NULL) ");
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "ledger表创建失败" << sqlQuery.lastError();
+        return;
+    }
+    sqlQuery.exec("CREATE INDEX ledger_srcName ON ledger(srcName)");
+    sqlQuery.exec("CREATE INDEX ledger_dstName ON ledger(dstName)");
+    qDebug() << "ledger表创建成功";
+
+    //期初余额：已有的余额作为一笔充值记入账本
+    QList<QSharedPointer<User>> users;
+    queryAllUser(users);
+    db.transaction();
+    sqlQuery.prepare("INSERT INTO ledger(srcName, dstName, amount, year, month, day) VALUES('', :dstName, :amount, -1, -1, -1)");
+    for (const QSharedPointer<User> &user : users)
+    {
+        if (user->getBalance() == 0)
+            continue;
+        sqlQuery.bindValue(":dstName", user->getUsername());
+        sqlQuery.bindValue(":amount", user->getBalance());
+        if (!sqlQuery.exec())
+            qCritical() << "数据库:记入 " << user->getUsername() << " 的期初余额失败" << sqlQuery.lastError();
+    }
+    db.commit();
+}
+
+void Database::loadUserSnapshot(QHash<QString, UserRecord> &users) const
+{
     QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+    if (!userFile.open(QIODevice::ReadOnly))
     {
         qCritical() << "user文件打开失败";
         exit(1);
     }
+    qint64 size = userFile.size();
+    if (size == 0)
+        return;
+    const char *data = reinterpret_cast<const char *>(userFile.map(0, size));
+    if (!data)
+    {
+        qCritical() << "user文件映射失败" << userFile.errorString();
+        exit(1);
+    }
+
+    //按行边界把文件切成若干块，在线程池中并行解析
+    int chunkCount = qMax(1, QThread::idealThreadCount());
+    QVector<UserChunk> chunks;
+    qint64 begin = 0;
+    for (int i = 1; i <= chunkCount && begin < size; i++)
+    {
+        qint64 end = qMax(begin, size * i / chunkCount);
+        while (end < size && data[end] != '\n')
+            end++;
+        if (end < size)
+            end++;
+        chunks.append(UserChunk{data + begin, data + end, {}});
+        begin = end;
+    }
+    QtConcurrent::blockingMap(chunks, &Database::parseUserChunk);
+
+    int total = 0;
+    for (const UserChunk &chunk : chunks)
+        total += chunk.users.size();
+    users.reserve(total);
+    for (const UserChunk &chunk : chunks)
+        for (const QPair<QString, UserRecord> &user : chunk.users)
+            users.insert(user.first, user.second);
+
+    userFile.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    userFile.close();
+    qDebug() << "文件：读取user快照成功，共" << users.size() << "个用户，分" << chunks.size() << "块解析";
+}
+
+void Database::parseUserChunk(UserChunk &chunk)
+{
+    const int FIELD_COUNT = 7; //用户名 密码 类型 余额 姓名 电话号码 地址
+    const char *fieldBegin[FIELD_COUNT];
+    int fieldLength[FIELD_COUNT];
+
+    for (const char *p = chunk.begin; p < chunk.end;)
+    {
+        const char *lineEnd = static_cast<const char *>(memchr(p, '\n', chunk.end - p));
+        if (!lineEnd)
+            lineEnd = chunk.end;
+
+        int n = 0;
+        while (p < lineEnd && n < FIELD_COUNT)
+        {
+            while (p < lineEnd && isspace(uchar(*p)))
+                p++;
+            if (p == lineEnd)
+                break;
+            fieldBegin[n] = p;
+            while (p < lineEnd && !isspace(uchar(*p)))
+                p++;
+            fieldLength[n] = int(p - fieldBegin[n]);
+            n++;
+        }
+        p = lineEnd + 1;
+        if (n < FIELD_COUNT)
+            continue;
+
+        //旧版文件由QTextStream按本地编码写入，这里按本地编码解码
+        auto field = [&](int i) { return QString::fromLocal8Bit(fieldBegin[i], fieldLength[i]); };
+        auto intField = [&](int i) { return QByteArray::fromRawData(fieldBegin[i], fieldLength[i]).toInt(); };
+        chunk.users.append(qMakePair(field(0), UserRecord{field(1), intField(2), intField(3), field(4), field(5), field(6)}));
+    }
+}
 
-    QTextStream stream;
-    bool isAdministratorExist = false;
-    stream.setDevice(&userFile);
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
+void Database::replayUserLog(QHash<QString, UserRecord> &users) const
+{
+    QFile userLogFile(userFileName + ".log");
+    if (!userLogFile.open(QIODevice::ReadOnly | QIODevice::Text))
+        return; //没有日志文件，说明快照之后没有修改
+
+    QTextStream stream(&userLogFile);
+    int cnt = 0;
     while (!stream.atEnd())
     {
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        usernameSet.insert(username);
-        if (username == "admin")
-            isAdministratorExist = true;
+        QStringList fields = stream.readLine().split(' ', Qt::SkipEmptyParts);
+        //每条记录以"#"结尾，没有结尾的记录是写到一半的记录，直接丢弃
+        if (fields.size() < 3 || fields.last() != "#")
+            continue;
+        cnt++;
+
+        const QString &op = fields[0];
+        const QString &username = fields[1];
+        if (op == "I" && fields.size() == 9)
+            users.insert(username, UserRecord{fields[2], fields[3].toInt(), fields[4].toInt(), fields[5], fields[6], fields[7]});
+        else if (op == "P" && fields.size() == 4 && users.contains(username))
+            users[username].password = fields[2];
+        else if (op == "B" && fields.size() == 4 && users.contains(username))
+            users[username].balance = fields[2].toInt();
+        else if (op == "D")
+            users.remove(username);
+        else
+            qWarning() << "user日志记录有误，已跳过" << fields.join(' ');
     }
-    if (!isAdministratorExist)
-        insertUser("admin", "123", ADMINISTRATOR, 0, "管理员", "88888888", "环宇物流大厦");
+    userLogFile.close();
+    qDebug() << "文件：重放user日志成功，共" << cnt << "条";
 }
 
 bool Database::modifyData(const QString &tableName, const QString &primaryKey, const QString &key, int value) const
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
+    QSqlQuery sqlQuery = preparedQuery("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
     sqlQuery.bindValue(":value", value);
     sqlQuery.bindValue(":primaryKey", primaryKey);
 
     exec(sqlQuery);
-    if (sqlQuery.exec())
+    if (sqlQuery.exec() && sqlQuery.numRowsAffected() > 0)
     {
         qDebug() << "数据库: " << key << " : "
                  << value
@@ -117,13 +982,12 @@ bool Database::modifyData(const QString &tableName, const QString &primaryKey, c
 
 bool Database::modifyData(const QString &tableName, const QString &primaryKey, const QString &key, const QString value) const
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
+    QSqlQuery sqlQuery = preparedQuery("UPDATE " + tableName + " SET " + key + " = :value WHERE " + getPrimaryKeyByTableName(tableName) + " = :primaryKey");
     sqlQuery.bindValue(":value", value);
     sqlQuery.bindValue(":primaryKey", primaryKey);
 
     exec(sqlQuery);
-    if (sqlQuery.exec())
+    if (sqlQuery.exec() && sqlQuery.numRowsAffected() > 0)
     {
         qDebug() << "数据库: " << key << " : "
                  << value
@@ -139,154 +1003,511 @@ bool Database::modifyData(const QString &tableName, const QString &primaryKey, c
     }
 }
 
-void Database::insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address)
+bool Database::insertUser(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address)
+{
+    if (hasLedger(username))
+    {
+        qCritical() << "数据库:用户名" << username << "在账本中还有记录，不能插入";
+        return false;
+    }
+
+    QSqlQuery sqlQuery = preparedQuery("INSERT INTO user VALUES(:username, :password, :type, :balance, :name, :phoneNumber, :address)");
+    sqlQuery.bindValue(":username", username);
+    sqlQuery.bindValue(":password", password);
+    sqlQuery.bindValue(":type", type);
+    sqlQuery.bindValue(":balance", balance);
+    sqlQuery.bindValue(":name", name);
+    sqlQuery.bindValue(":phoneNumber", phoneNumber);
+    sqlQuery.bindValue(":address", address);
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:插入user " << username << " 失败" << sqlQuery.lastError();
+        return false;
+    }
+    qDebug() << "数据库:插入user " << username << " 成功";
+    return true;
+}
+
+QSharedPointer<User> Database::queryUserByName(const QString &targetUsername) const
+{
+    QSqlQuery sqlQuery = preparedQuery("SELECT * FROM user WHERE username = :username");
+    sqlQuery.bindValue(":username", targetUsername);
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:查找user " << targetUsername << " 失败" << sqlQuery.lastError();
+        return NULL;
+    }
+    QSharedPointer<User> result;
+    if (sqlQuery.next())
+        result = query2User(sqlQuery);
+    sqlQuery.finish();
+    return result;
+}
+
+int Database::queryBalanceByName(const QString &username) const
+{
+    QSharedPointer<User> user = queryUserByName(username);
+    if (user)
+        return user->getBalance();
+    else
+        return -1;
+}
+
+bool Database::modifyUserPassword(const QString &targetUsername, const QString &targetPassword) const
+{
+    return modifyData("user", targetUsername, "password", targetPassword);
+}
+
+bool Database::modifyUserBalance(const QString &targetUsername, int targetBalance) const
+{
+    return modifyData("user", targetUsername, "balance", targetBalance);
+}
+
+bool Database::transferBalance(const QString &srcName, const QString &dstName, int amount, const Time &time)
 {
-    if (!usernameSet.contains(username))
+    //组提交时已在事务中，用保存点保证这笔转账整体成功或整体撤销
+    if (groupCommitting)
+        QSqlQuery(db).exec("SAVEPOINT transfer");
+    else
+        db.transaction();
+
+    QSqlQuery sqlQuery = preparedQuery("INSERT INTO ledger(srcName, dstName, amount, year, month, day) VALUES(:srcName, :dstName, :amount, :year, :month, :day)");
+    sqlQuery.bindValue(":srcName", srcName);
+    sqlQuery.bindValue(":dstName", dstName);
+    sqlQuery.bindValue(":amount", amount);
+    sqlQuery.bindValue(":year", time.year);
+    sqlQuery.bindValue(":month", time.month);
+    sqlQuery.bindValue(":day", time.day);
+    exec(sqlQuery);
+    bool ok = sqlQuery.exec();
+    int id = sqlQuery.lastInsertId().toInt();
+
+    if (ok)
     {
-        qDebug() << "文件：插入user " << username << " 成功";
-        usernameSet.insert(username);
-        QFile userFile(userFileName);
-        if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+        sqlQuery = preparedQuery("UPDATE user SET balance = balance + :amount WHERE username = :username");
+        if (!srcName.isEmpty())
         {
-            qCritical() << "user文件打开失败";
-            exit(1);
+            sqlQuery.bindValue(":amount", -amount);
+            sqlQuery.bindValue(":username", srcName);
+            ok = sqlQuery.exec() && sqlQuery.numRowsAffected() > 0;
+        }
+        if (ok && !dstName.isEmpty())
+        {
+            sqlQuery.bindValue(":amount", amount);
+            sqlQuery.bindValue(":username", dstName);
+            ok = sqlQuery.exec() && sqlQuery.numRowsAffected() > 0;
         }
-        QTextStream stream(&userFile);
+    }
+
+    if (groupCommitting)
+    {
+        QSqlQuery savepointQuery(db);
+        if (!ok)
+            savepointQuery.exec("ROLLBACK TO transfer");
+        savepointQuery.exec("RELEASE transfer");
+    }
+    else if (!ok || !db.commit())
+    {
+        ok = false;
+        db.rollback();
+    }
+    if (!ok)
+    {
+        qCritical() << "数据库:" << srcName << "向" << dstName << "转账" << amount << "失败" << sqlQuery.lastError();
+        return false;
+    }
+
+    qDebug() << "数据库:" << srcName << "向" << dstName << "转账" << amount << "成功";
+    return true;
+}
+
+bool Database::hasLedger(const QString &username) const
+{
+    QSqlQuery sqlQuery = preparedQuery("SELECT 1 FROM ledger WHERE srcName = :srcName OR dstName = :dstName LIMIT 1");
+    sqlQuery.bindValue(":srcName", username);
+    sqlQuery.bindValue(":dstName", username);
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:查询" << username << "的账本记录失败" << sqlQuery.lastError();
+        return true; //查不到时按有记录处理，宁可拒绝注册
+    }
+    bool found = sqlQuery.next();
+    sqlQuery.finish();
+    return found;
+}
+
+int Database::queryLedgerByName(QList<LedgerEntry> &result, const QString &username) const
+{
+    QSqlQuery sqlQuery = preparedQuery("SELECT * FROM ledger WHERE srcName = :srcName OR dstName = :dstName ORDER BY id");
+    sqlQuery.bindValue(":srcName", username);
+    sqlQuery.bindValue(":dstName", username);
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:查找 " << username << " 的账本记录失败" << sqlQuery.lastError();
+        return 0;
+    }
+
+    int cnt = 0;
+    while (sqlQuery.next())
+    {
+        result.append({sqlQuery.value(0).toInt(), sqlQuery.value(1).toString(), sqlQuery.value(2).toString(), sqlQuery.value(3).toInt(), Time(sqlQuery.value(4).toInt(), sqlQuery.value(5).toInt(), sqlQuery.value(6).toInt())});
+        cnt++;
+    }
+    sqlQuery.finish();
+    return cnt;
+}
+
+void Database::queryItemCounts(QHash<QString, QHash<int, int>> &result) const
+{
+    flushPendingItems();
+    QSqlQuery sqlQuery(db);
+    if (!sqlQuery.exec("SELECT expressman, state, COUNT(*) FROM (SELECT expressman, state FROM item UNION ALL SELECT expressman, state FROM item_archive)"
+                       " GROUP BY expressman, state"))
+    {
+        qCritical() << "数据库:统计物品数失败" << sqlQuery.lastError();
+        return;
+    }
+    while (sqlQuery.next())
+        result[sqlQuery.value(0).toString()][sqlQuery.value(1).toInt()] = sqlQuery.value(2).toInt();
+}
+
+void Database::queryDailyNetIncome(QMap<int, int> &result, const QString &username) const
+{
+    QSqlQuery sqlQuery(db);
+    sqlQuery.prepare("SELECT year * 372 + (month - 1) * 31 + (day - 1) AS dayNumber,"
+                     " SUM(CASE WHEN dstName = :username THEN amount ELSE -amount END) FROM ledger"
+                     " WHERE (srcName = :srcName OR dstName = :dstName) AND srcName <> '' AND dstName <> ''"
+                     " GROUP BY dayNumber");
+    sqlQuery.bindValue(":username", username);
+    sqlQuery.bindValue(":srcName", username);
+    sqlQuery.bindValue(":dstName", username);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:统计 " << username << " 的收入失败" << sqlQuery.lastError();
+        return;
+    }
+    while (sqlQuery.next())
+        result[sqlQuery.value(0).toInt()] = sqlQuery.value(1).toInt();
+}
+
+void Database::appendPendingItem(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
+{
+    QVariantList row{id, cost, type, state, sendingDay, receivingDay, srcName, dstName, expressman, description};
+    pendingItems.resize(row.size());
+    for (int i = 0; i < row.size(); i++)
+        pendingItems[i].append(row[i]);
+    for (const QString &gram : descriptionGrams(description))
+    {
+        pendingGrams.append(gram);
+        pendingGramIds.append(id);
+    }
+    if (itemColumns)
+        itemColumns->insert(id, cost, type, state, sendingDay, receivingDay, srcName, dstName, expressman, description);
+}
+
+int Database::importItems(QTextStream &in)
+{
+    //先完整检查一遍文件，有一行有误就什么也不写，不会留下导入了一半的数据
+    QStringList fields;
+    QSet<int> ids;
+    int id, cost, type, state, line = 0;
+    Time sendingTime, receivingTime;
+    while (readCsvRecord(in, fields))
+    {
+        line++;
+        if (line == 1 && fields.value(0) == "id") //表头
+            continue;
+        if (!parseItemRecord(fields, id, cost, type, state, sendingTime, receivingTime))
+        {
+            qCritical() << "数据库:导入物品失败，第" << line << "行格式有误";
+            return -1;
+        }
+        if (ids.contains(id))
+        {
+            qCritical() << "数据库:导入物品失败，第" << line << "行的单号" << id << "在文件中重复";
+            return -1;
+        }
+        ids.insert(id);
+    }
+    if (!in.seek(0))
+    {
+        qCritical() << "数据库:导入物品失败，无法重新读取文件";
+        return -1;
+    }
+
+    if (groupCommitting && !commitGroupCommit())
+        return -1;
+
+    //已在item表或归档表中的单号跳过，不覆盖已有的物品
+    QSet<int> existing;
+    QVector<int> idList = ids.values().toVector();
+    QSqlQuery sqlQuery(db);
+    sqlQuery.setForwardOnly(true);
+    for (const QString &tableName : {QString("item"), QString("item_archive")})
+        for (int begin = 0; begin < idList.size(); begin += BULK_ID_CHUNK)
+        {
+            int n = std::min(BULK_ID_CHUNK, idList.size() - begin);
+            sqlQuery.prepare("SELECT id FROM " + tableName + " WHERE id IN (" + idPlaceholders(n) + ")");
+            for (int i = 0; i < n; i++)
+                sqlQuery.bindValue(":id" + QString::number(i), idList[begin + i]);
+            if (!sqlQuery.exec())
+            {
+                qCritical() << "数据库:导入物品失败，无法检查已有的单号" << sqlQuery.lastError();
+                return -1;
+            }
+            while (sqlQuery.next())
+                existing.insert(sqlQuery.value(0).toInt());
+            sqlQuery.finish();
+        }
+    if (!existing.isEmpty())
+        qWarning() << "数据库:有" << existing.size() << "个物品的单号已存在，跳过";
+
+    int cnt = 0, committed = 0;
+    line = 0;
+    beginGroupCommit();
+    while (readCsvRecord(in, fields))
+    {
+        line++;
+        if (line == 1 && fields.value(0) == "id") //表头
+            continue;
+        parseItemRecord(fields, id, cost, type, state, sendingTime, receivingTime);
+        if (existing.contains(id))
+            continue;
+        appendPendingItem(id, cost, type, state, sendingTime.toDayNumber(), receivingTime.toDayNumber(), fields[6], fields[7], fields[8], fields[9]);
 
-        int tempType, tempBalance;
-        QString tempUsername, tempPassword, tempName, tempPhoneNumber, tempAddress;
-        char ch;
-        while (!stream.atEnd())
+        if (++cnt % BULK_BATCH_SIZE == 0)
         {
-            stream >> tempUsername >> tempPassword >> tempType >> tempType >> tempName >> tempPhoneNumber >> tempAddress;
-            stream >> ch;
+            if (!commitGroupCommit())
+            {
+                qCritical() << "数据库:导入物品失败，之前的" << committed << "个物品已提交";
+                return -1;
+            }
+            committed = cnt;
+            qInfo() << "数据库:已导入" << cnt << "个物品";
+            beginGroupCommit();
         }
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        stream << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
-        userFile.close();
     }
-    else
-        qCritical() << "文件：插入user " << username << "失败"
-                    << "该用户已存在文件中";
+    if (!commitGroupCommit())
+    {
+        qCritical() << "数据库:导入物品失败，之前的" << committed << "个物品已提交";
+        return -1;
+    }
+    qInfo() << "数据库:导入物品完成，共" << cnt << "个";
+    return cnt;
 }
 
-QSharedPointer<User> Database::queryUserByName(const QString &targetUsername) const
+int Database::exportItems(QTextStream &out) const
 {
-    QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+    flushPendingItems();
+    QSqlQuery sqlQuery(db);
+    sqlQuery.setForwardOnly(true);
+    if (!sqlQuery.exec("SELECT * FROM item UNION ALL SELECT * FROM item_archive ORDER BY id"))
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        qCritical() << "数据库:导出物品失败" << sqlQuery.lastError();
+        return -1;
+    }
+
+    int cnt = 0;
+    out << "id,cost,type,state,sendingTime,receivingTime,srcName,dstName,expressman,description\n";
+    while (sqlQuery.next())
+    {
+        out << sqlQuery.value(0).toInt() << ',' << sqlQuery.value(1).toInt() << ',' << sqlQuery.value(2).toInt() << ',' << sqlQuery.value(3).toInt() << ','
+            << csvTime(Time::fromDayNumber(sqlQuery.value(4).toInt())) << ',' << csvTime(Time::fromDayNumber(sqlQuery.value(5).toInt())) << ','
+            << csvField(sqlQuery.value(6).toString()) << ',' << csvField(sqlQuery.value(7).toString()) << ',' << csvField(sqlQuery.value(8).toString()) << ','
+            << csvField(sqlQuery.value(9).toString()) << '\n';
+        cnt++;
+    }
+    sqlQuery.finish();
+    qInfo() << "数据库:导出物品完成，共" << cnt << "个";
+    return cnt;
+}
+
+int Database::importUsers(QTextStream &in)
+{
+    //先完整检查一遍文件，有一行有误就什么也不写
+    QStringList fields;
+    int type, balance, line = 0;
+    while (readCsvRecord(in, fields))
+    {
+        line++;
+        if (line == 1 && fields.value(0) == "username") //表头
+            continue;
+        if (!parseUserRecord(fields, type, balance))
+        {
+            qCritical() << "数据库:导入用户失败，第" << line << "行格式有误";
+            return -1;
+        }
+    }
+    if (!in.seek(0))
+    {
+        qCritical() << "数据库:导入用户失败，无法重新读取文件";
+        return -1;
     }
-    QTextStream stream(&userFile);
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
 
-    while (!stream.atEnd())
-    {
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        if (username == targetUsername)
+    if (groupCommitting && !commitGroupCommit())
+        return -1;
+    int cnt = 0, committed = 0;
+    line = 0;
+    beginGroupCommit();
+    while (readCsvRecord(in, fields))
+    {
+        line++;
+        if (line == 1 && fields.value(0) == "username") //表头
+            continue;
+        parseUserRecord(fields, type, balance);
+        if (queryBalanceByName(fields[0]) != -1)
+        {
+            qWarning() << "数据库:用户" << fields[0] << "已存在，跳过";
+            continue;
+        }
+        if (hasLedger(fields[0]))
+        {
+            qWarning() << "数据库:用户名" << fields[0] << "属于已删除的用户，跳过";
+            continue;
+        }
+
+        //余额作为一笔期初余额记入账本
+        if (!insertUser(fields[0], fields[1], type, 0, fields[4], fields[5], fields[6]) ||
+            (balance && !transferBalance("", fields[0], balance, Time(-1, -1, -1))))
+        {
+            rollbackGroupCommit();
+            qCritical() << "数据库:导入用户失败，之前的" << committed << "个用户已提交";
+            return -1;
+        }
+
+        if (++cnt % BULK_BATCH_SIZE == 0)
         {
-            userFile.close();
-            return query2User(username, password, type, balance, name, phoneNumber, address);
+            if (!commitGroupCommit())
+            {
+                qCritical() << "数据库:导入用户失败，之前的" << committed << "个用户已提交";
+                return -1;
+            }
+            committed = cnt;
+            qInfo() << "数据库:已导入" << cnt << "个用户";
+            beginGroupCommit();
         }
     }
-    return NULL;
-}
-
-int Database::queryBalanceByName(const QString &username) const
-{
-    QSharedPointer<User> user = queryUserByName(username);
-    if (user)
-        return user->getBalance();
-    else
+    if (!commitGroupCommit())
+    {
+        qCritical() << "数据库:导入用户失败，之前的" << committed << "个用户已提交";
         return -1;
+    }
+    qInfo() << "数据库:导入用户完成，共" << cnt << "个";
+    return cnt;
 }
 
-bool Database::modifyUserPassword(const QString &targetUsername, const QString &targetPassword) const
+int Database::exportUsers(QTextStream &out) const
 {
-    if (!usernameSet.contains(targetUsername))
-        return false;
+    int cnt = 0;
+    auto writeUser = [&out, &cnt](const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address) {
+        out << csvField(username) << ',' << csvField(password) << ',' << type << ',' << balance << ','
+            << csvField(name) << ',' << csvField(phoneNumber) << ',' << csvField(address) << '\n';
+        cnt++;
+    };
 
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
-    {
-        qCritical() << "user文件打开失败";
-        exit(1);
-    }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
+    out << "username,password,type,balance,name,phoneNumber,address\n";
+    QSqlQuery sqlQuery(db);
+    sqlQuery.setForwardOnly(true);
+    if (!sqlQuery.exec("SELECT * FROM user"))
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        qCritical() << "数据库:导出用户失败" << sqlQuery.lastError();
+        return -1;
     }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
+    while (sqlQuery.next())
+        writeUser(sqlQuery.value(0).toString(), sqlQuery.value(1).toString(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(),
+                  sqlQuery.value(4).toString(), sqlQuery.value(5).toString(), sqlQuery.value(6).toString());
+    sqlQuery.finish();
+    qInfo() << "数据库:导出用户完成，共" << cnt << "个";
+    return cnt;
+}
 
-    while (!stream1.atEnd())
+bool Database::insertGrams(const QVariantList &grams, const QVariantList &ids) const
+{
+    if (grams.isEmpty())
+        return true;
+    QSqlQuery sqlQuery = preparedQuery("INSERT OR IGNORE INTO item_gram VALUES(:gram, :id)");
+    sqlQuery.bindValue(":gram", grams);
+    sqlQuery.bindValue(":id", ids);
+    if (!sqlQuery.execBatch())
     {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username == targetUsername)
-            password = targetPassword;
-        stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
+        qCritical() << "数据库:插入描述索引失败" << sqlQuery.lastError();
+        return false;
     }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
     return true;
 }
 
-bool Database::modifyUserBalance(const QString &targetUsername, int targetBalance) const
+void Database::createDescriptionIndex()
 {
-    if (!usernameSet.contains(targetUsername))
-        return false;
-
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
+    QSqlQuery sqlQuery(db);
+    //(词项, 单号)为主键，不另存rowid；单号上的索引用于删除物品时删除词项
+    if (!sqlQuery.exec("CREATE TABLE item_gram( gram TEXT NOT NULL, id INT NOT NULL, PRIMARY KEY(gram, id)) WITHOUT ROWID") ||
+        !sqlQuery.exec("CREATE INDEX item_gram_id ON item_gram(id)"))
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        qCritical() << "item_gram表创建失败" << sqlQuery.lastError();
+        return;
     }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
+
+    //为已有的物品建立索引
+    QVariantList grams, ids;
+    sqlQuery.setForwardOnly(true);
+    sqlQuery.exec("SELECT id, description FROM item UNION ALL SELECT id, description FROM item_archive");
+    while (sqlQuery.next())
+        for (const QString &gram : descriptionGrams(sqlQuery.value(1).toString()))
+        {
+            grams.append(gram);
+            ids.append(sqlQuery.value(0));
+        }
+    sqlQuery.finish();
+    db.transaction();
+    if (!insertGrams(grams, ids) || !db.commit())
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        db.rollback();
+        return;
     }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
+    qDebug() << "item_gram表创建成功，共" << grams.size() << "个词项";
+}
+
+bool Database::flushPendingItems() const
+{
+    if (pendingItems.isEmpty() || pendingItems[0].isEmpty())
+        return true;
 
-    while (!stream1.atEnd())
+    static const char *const placeholders[] = {":id", ":cost", ":type", ":state", ":sendingDay", ":receivingDay",
+                                               ":srcName", ":dstName", ":expressman", ":description"};
+    QSqlQuery sqlQuery = preparedQuery("INSERT INTO item VALUES(:id, :cost, :type, :state, :sendingDay, :receivingDay,"
+                                       " :srcName, :dstName, :expressman, :description)");
+    for (int i = 0; i < pendingItems.size(); i++)
+        sqlQuery.bindValue(placeholders[i], pendingItems[i]);
+    int cnt = pendingItems[0].size();
+    pendingItems.clear();
+    QVariantList grams, gramIds;
+    grams.swap(pendingGrams);
+    gramIds.swap(pendingGramIds);
+
+    if (!sqlQuery.execBatch() || !insertGrams(grams, gramIds))
     {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username == targetUsername)
-            balance = targetBalance;
-        stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
+        qCritical() << "数据库:批量插入" << cnt << "个物品项失败" << sqlQuery.lastError();
+        pendingItemsFailed = true;
+        return false;
     }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
+    qDebug() << "数据库:批量插入" << cnt << "个物品项成功";
     return true;
 }
 
 int Database::getDBMaxId(const QString &tableName) const
 {
+    if (tableName == "item")
+        flushPendingItems();
     QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("SELECT MAX(id) FROM " + tableName);
+    if (tableName == "item") //归档的物品也占用单号
+        sqlQuery.prepare("SELECT MAX(id) FROM (SELECT MAX(id) AS id FROM item UNION ALL SELECT MAX(id) FROM item_archive)");
+    else
+        sqlQuery.prepare("SELECT MAX(id) FROM " + tableName);
 
     exec(sqlQuery);
     if (!sqlQuery.exec())
@@ -303,35 +1524,76 @@ int Database::getDBMaxId(const QString &tableName) const
     }
 }
 
-void Database::insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
+int Database::countRows(const QString &tableName) const
 {
+    if (tableName == "item")
+        flushPendingItems();
     QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("INSERT INTO item VALUES(:id, :cost, :type, :state,"
-                     " :sendingTime_Year, :sendingTime_Month, :sendingTime_Day,"
-                     " :receivingTime_Year, :receivingTime_Month, :receivingTime_Day,"
-                     " :srcName, :dstName, :expressman, :description)");
+    if (tableName == "item")
+        sqlQuery.prepare("SELECT (SELECT COUNT(*) FROM item) + (SELECT COUNT(*) FROM item_archive)");
+    else
+        sqlQuery.prepare("SELECT COUNT(*) FROM " + tableName);
+
+    exec(sqlQuery);
+    if (!sqlQuery.exec() || !sqlQuery.next())
+    {
+        qCritical() << "数据库:获得表 " << tableName << " 的行数失败" << sqlQuery.lastError();
+        return -1;
+    }
+    return sqlQuery.value(0).toInt();
+}
+
+bool Database::insertItem(int id, int cost, int type, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
+{
+    if (groupCommitting)
+    {
+        appendPendingItem(id, cost, type, state, sendingTime.toDayNumber(), receivingTime.toDayNumber(), srcName, dstName, expressman, description);
+        qDebug() << "数据库:id为 " << id << " 的物品项等待批量插入";
+        return true;
+    }
+
+    //物品和它的描述词项在同一个事务中插入，词项插入失败则物品也不插入
+    db.transaction();
+    QSqlQuery sqlQuery = preparedQuery("INSERT INTO item VALUES(:id, :cost, :type, :state, :sendingDay, :receivingDay,"
+                                       " :srcName, :dstName, :expressman, :description)");
     sqlQuery.bindValue(":id", id);
     sqlQuery.bindValue(":cost", cost);
     sqlQuery.bindValue(":type", type);
     sqlQuery.bindValue(":state", state);
-    sqlQuery.bindValue(":sendingTime_Year", sendingTime.year);
-    sqlQuery.bindValue(":sendingTime_Month", sendingTime.month);
-    sqlQuery.bindValue(":sendingTime_Day", sendingTime.day);
-    sqlQuery.bindValue(":receivingTime_Year", receivingTime.year);
-    sqlQuery.bindValue(":receivingTime_Month", receivingTime.month);
-    sqlQuery.bindValue(":receivingTime_Day", receivingTime.day);
+    sqlQuery.bindValue(":sendingDay", sendingTime.toDayNumber());
+    sqlQuery.bindValue(":receivingDay", receivingTime.toDayNumber());
     sqlQuery.bindValue(":srcName", srcName);
     sqlQuery.bindValue(":dstName", dstName);
     sqlQuery.bindValue(":expressman", expressman);
     sqlQuery.bindValue(":description", description);
     exec(sqlQuery);
-    if (!sqlQuery.exec())
+    bool ok = sqlQuery.exec();
+    if (ok)
+    {
+        QVariantList grams, ids;
+        for (const QString &gram : descriptionGrams(description))
+        {
+            grams.append(gram);
+            ids.append(id);
+        }
+        ok = insertGrams(grams, ids);
+    }
+    if (!ok || !db.commit())
+    {
         qCritical() << "数据库:插入id为 " << id << " 的物品项失败 " << sqlQuery.lastError();
-    else
-        qDebug() << "数据库:插入id为 " << id << " 的物品项成功 ";
+        db.rollback();
+        return false;
+    }
+    qDebug() << "数据库:插入id为 " << id << " 的物品项成功 ";
+    if (itemColumns)
+    {
+        itemColumns->insert(id, cost, type, state, sendingTime.toDayNumber(), receivingTime.toDayNumber(), srcName, dstName, expressman, description);
+        commitItemColumns();
+    }
+    return true;
 }
 
-QSharedPointer<User> Database::query2User(const QString &username, QString &password, int &type, int &balance, QString &name, QString &phoneNumber, QString &address) const
+QSharedPointer<User> Database::query2User(const QString &username, const QString &password, int type, int balance, const QString &name, const QString &phoneNumber, const QString &address) const
 {
     QSharedPointer<User> result;
     switch (type)
@@ -349,184 +1611,384 @@ QSharedPointer<User> Database::query2User(const QString &username, QString &pass
     return result;
 }
 
-QSharedPointer<Item> Database::query2Item(const QSqlQuery &sqlQuery) const
+QSharedPointer<User> Database::query2User(const QSqlQuery &sqlQuery) const
 {
-    Time sendingTime{sqlQuery.value(4).toInt(), sqlQuery.value(5).toInt(), sqlQuery.value(6).toInt()};
-    Time receivingTime{sqlQuery.value(7).toInt(), sqlQuery.value(8).toInt(), sqlQuery.value(9).toInt()};
+    return query2User(sqlQuery.value(0).toString(), sqlQuery.value(1).toString(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toString(), sqlQuery.value(5).toString(), sqlQuery.value(6).toString());
+}
 
-    QSharedPointer<Item> result;
-    switch (sqlQuery.value(2).toInt())
-    {
-    case FRAGILE:
-        result = QSharedPointer<FragileItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
-        break;
-    case BOOK:
-        result = QSharedPointer<Book>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
-        break;
-    case NORMAL:
-        result = QSharedPointer<NormalItem>::create(sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(3).toInt(), sendingTime, receivingTime, sqlQuery.value(10).toString(), sqlQuery.value(11).toString(), sqlQuery.value(12).toString(), sqlQuery.value(13).toString());
-        break;
-    }
+ItemRow Database::query2Row(const QSqlQuery &sqlQuery) const
+{
+    return {sqlQuery.value(0).toInt(), sqlQuery.value(1).toInt(), sqlQuery.value(2).toInt(), sqlQuery.value(3).toInt(), sqlQuery.value(4).toInt(), sqlQuery.value(5).toInt(),
+            sqlQuery.value(6).toString(), sqlQuery.value(7).toString(), sqlQuery.value(8).toString(), sqlQuery.value(9).toString()};
+}
 
-    return result;
+int Database::queryAllUser(QList<QSharedPointer<User>> &result) const
+{
+    return queryAllUser([&result](const QSharedPointer<User> &user) { result.append(user); });
 }
 
-int Database::queryAllUser(QList<QSharedPointer<User>> &result)
+int Database::queryAllUser(const UserSink &sink) const
 {
+    QSqlQuery sqlQuery(db);
+    sqlQuery.setForwardOnly(true);
+    sqlQuery.prepare("SELECT * FROM user");
 
-    QFile userFile(userFileName);
-    if (!userFile.open(QIODevice::ReadWrite | QIODevice ::Text))
+    exec(sqlQuery);
+    if (!sqlQuery.exec())
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        qCritical() << "数据库:查找所有user失败" << sqlQuery.lastError();
+        return 0;
     }
-    QTextStream stream(&userFile);
-    int type, balance, cnt = 0;
-    QString username, password, name, phoneNumber, address;
-    char ch;
 
-    while (!stream.atEnd())
+    int cnt = 0;
+    while (sqlQuery.next())
     {
+        sink(query2User(sqlQuery));
         cnt++;
-        stream >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream >> ch;
-        result.append(query2User(username, password, type, balance, name, phoneNumber, address));
     }
-
-    userFile.close();
     return cnt;
 }
 
-int Database::queryItemByFilter(QList<QSharedPointer<Item>> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman) const
+int Database::queryItemByFilter(const ItemSink &sink, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom, const Time &sendingTo, const ItemPage &page, const QString &descriptionContains) const
 {
-    QSqlQuery sqlQuery(db);
-    QString queryString("SELECT * FROM item");
-    bool flag = false;
-    if (id != -1)
+    bool onWriter = QThread::currentThread() == writerThread;
+    if (itemColumns && descriptionContains.isEmpty() && !(onWriter && groupCommitting))
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "id = :id";
-        flag = true;
+        int cnt = itemColumns->query(sink, id, state, sendingTime, receivingTime, srcName, dstName, expressman, sendingFrom, sendingTo, page);
+        if (cnt != -1)
+            return cnt;
     }
+    if (onWriter) //写连接要先看到本组中刚插入的物品
+        flushPendingItems();
+    int filterMask = 0;
+    if (id != -1)
+        filterMask |= ITEM_FILTER_ID;
     if (state != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "state = :state";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_STATE;
     if (sendingTime.year != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Year = :sendingTime_Year";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_SENDING_YEAR;
     if (sendingTime.month != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Month = :sendingTime_Month";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_SENDING_MONTH;
     if (sendingTime.day != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "sendingTime_Day = :sendingTime_Day";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_SENDING_DAY;
     if (receivingTime.year != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Year = :receivingTime_Year";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_RECEIVING_YEAR;
     if (receivingTime.month != -1)
-    {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Month = :receivingTime_Month";
-        flag = true;
-    }
+        filterMask |= ITEM_FILTER_RECEIVING_MONTH;
     if (receivingTime.day != -1)
+        filterMask |= ITEM_FILTER_RECEIVING_DAY;
+    if (sendingFrom.year != -1)
+        filterMask |= ITEM_FILTER_SENDING_FROM;
+    if (sendingTo.year != -1)
+        filterMask |= ITEM_FILTER_SENDING_TO;
+    if (page.afterId != -1)
+        filterMask |= ITEM_FILTER_AFTER;
+    if (page.limit != -1)
+        filterMask |= ITEM_FILTER_LIMIT;
+    if (page.orderBy == ORDER_BY_SENDING_TIME)
+        filterMask |= ITEM_FILTER_ORDER_SENDING_TIME;
+    if (!srcName.isEmpty())
+        filterMask |= ITEM_FILTER_SRC_NAME;
+    if (!dstName.isEmpty())
+        filterMask |= ITEM_FILTER_DST_NAME;
+    if (!expressman.isEmpty())
+        filterMask |= ITEM_FILTER_EXPRESSMAN;
+    if (!descriptionContains.isEmpty())
+        filterMask |= ITEM_FILTER_DESCRIPTION;
+
+    //两张表用同样的条件查询，每张表的结果各自有序
+    auto openTable = [&](int mask, QSqlQuery &sqlQuery) {
+        sqlQuery = preparedItemFilterQuery(mask);
+
+        if (id != -1)
+            sqlQuery.bindValue(":id", id);
+        if (state != -1)
+            sqlQuery.bindValue(":state", state);
+        bindDayConditions(sqlQuery, "sendingDay", sendingTime);
+        bindDayConditions(sqlQuery, "receivingDay", receivingTime);
+        if (sendingFrom.year != -1)
+            sqlQuery.bindValue(":sendingFrom", sendingFrom.firstDayNumber());
+        if (sendingTo.year != -1)
+            sqlQuery.bindValue(":sendingTo", sendingTo.lastDayNumber());
+        if (!srcName.isEmpty())
+            sqlQuery.bindValue(":srcName", srcName);
+        if (!dstName.isEmpty())
+            sqlQuery.bindValue(":dstName", dstName);
+        if (!expressman.isEmpty())
+            sqlQuery.bindValue(":expressman", expressman);
+        if (!descriptionContains.isEmpty())
+        {
+            //一个字的用一元词项，否则用首尾两个二元词项
+            sqlQuery.bindValue(":firstGram", descriptionContains.left(2));
+            sqlQuery.bindValue(":lastGram", descriptionContains.right(2));
+            sqlQuery.bindValue(":description", descriptionContains);
+        }
+        if (page.afterId != -1)
+        {
+            sqlQuery.bindValue(":afterId", page.afterId);
+            if (page.orderBy == ORDER_BY_SENDING_TIME)
+                sqlQuery.bindValue(":afterKey", page.afterKey);
+        }
+        if (page.limit != -1)
+            sqlQuery.bindValue(":limit", page.limit);
+
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:查找物品失败" << sqlQuery.lastError();
+            return false;
+        }
+        return true;
+    };
+
+    int cnt = 0;
+    auto drain = [&](QSqlQuery &sqlQuery) {
+        while (cnt != page.limit && sqlQuery.next())
+        {
+            sink(query2Row(sqlQuery));
+            cnt++;
+        }
+        sqlQuery.finish();
+    };
+
+    QSqlQuery hot, archived;
+    if (!openTable(filterMask, hot))
+        return 0;
+
+    //归档表中只有签收日不晚于archivedUntil的已签收物品，条件不可能匹配时不读归档表
+    int until = archivedUntil.loadAcquire();
+    if (until == -1 || (state != -1 && state != RECEIVED) ||
+        (receivingTime.year != -1 && receivingTime.firstDayNumber() > until) ||
+        (sendingTime.year != -1 && sendingTime.firstDayNumber() > until) ||
+        (sendingFrom.year != -1 && sendingFrom.firstDayNumber() > until))
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "receivingTime_Day = :receivingTime_Day";
-        flag = true;
+        drain(hot);
+        qDebug() << "数据库:查找物品成功，共" << cnt << "条";
+        return cnt;
     }
-    if (!srcName.isEmpty())
+
+    //按单号查询时至多一条，item表中没有才查归档表
+    if (id != -1)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "srcName = :srcName";
-        flag = true;
+        drain(hot);
+        if (!cnt && openTable(filterMask | ITEM_FILTER_ARCHIVE, archived))
+            drain(archived);
+        qDebug() << "数据库:查找物品成功，共" << cnt << "条";
+        return cnt;
     }
-    if (!dstName.isEmpty())
+
+    if (!openTable(filterMask | ITEM_FILTER_ARCHIVE, archived))
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "dstName = :dstName";
-        flag = true;
+        drain(hot);
+        return cnt;
     }
-    if (!expressman.isEmpty())
+
+    //两个游标同时前进，按(排序键, 单号)归并，凑满一页就停止
+    auto before = [&page](const ItemRow &a, const ItemRow &b) {
+        if (page.orderBy == ORDER_BY_SENDING_TIME && a.sendingDay != b.sendingDay)
+            return a.sendingDay < b.sendingDay;
+        return a.id < b.id;
+    };
+    ItemRow hotRow, archivedRow;
+    bool hasHot = hot.next(), hasArchived = archived.next();
+    if (hasHot)
+        hotRow = query2Row(hot);
+    if (hasArchived)
+        archivedRow = query2Row(archived);
+    while ((hasHot || hasArchived) && cnt != page.limit)
     {
-        queryString += QString(flag ? " AND " : " WHERE ") + "expressman = :expressman";
-        flag = true;
+        if (hasHot && (!hasArchived || before(hotRow, archivedRow)))
+        {
+            sink(hotRow);
+            if ((hasHot = hot.next()))
+                hotRow = query2Row(hot);
+        }
+        else
+        {
+            sink(archivedRow);
+            if ((hasArchived = archived.next()))
+                archivedRow = query2Row(archived);
+        }
+        cnt++;
     }
-    sqlQuery.prepare(queryString);
+    hot.finish();
+    archived.finish();
+    qDebug() << "数据库:查找物品成功，共" << cnt << "条";
+    return cnt;
+}
 
-    if (id != -1)
-        sqlQuery.bindValue(":id", id);
-    if (state != -1)
-        sqlQuery.bindValue(":state", state);
-    if (sendingTime.year != -1)
-        sqlQuery.bindValue(":sendingTime_Year", sendingTime.year);
-    if (sendingTime.month != -1)
-        sqlQuery.bindValue(":sendingTime_Month", sendingTime.month);
-    if (sendingTime.day != -1)
-        sqlQuery.bindValue(":sendingTime_Day", sendingTime.day);
-    if (receivingTime.year != -1)
-        sqlQuery.bindValue(":receivingTime_Year", receivingTime.year);
-    if (receivingTime.month != -1)
-        sqlQuery.bindValue(":receivingTime_Month", receivingTime.month);
-    if (receivingTime.day != -1)
-        sqlQuery.bindValue(":receivingTime_Day", receivingTime.day);
-    if (!srcName.isEmpty())
-        sqlQuery.bindValue(":srcName", srcName);
-    if (!dstName.isEmpty())
-        sqlQuery.bindValue(":dstName", dstName);
-    if (!expressman.isEmpty())
-        sqlQuery.bindValue(":expressman", expressman);
+int Database::queryItemByFilter(QVector<ItemRow> &result, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom, const Time &sendingTo, const ItemPage &page, const QString &descriptionContains) const
+{
+    if (page.limit != -1)
+        result.reserve(result.size() + page.limit);
+    return queryItemByFilter([&result](const ItemRow &row) { result.append(row); },
+                             id, state, sendingTime, receivingTime, srcName, dstName, expressman, sendingFrom, sendingTo, page, descriptionContains);
+}
+
+bool Database::modifyItem(const int id, const ItemPatch &patch)
+{
+    flushPendingItems();
+    QStringList assignments;
+    if (patch.state != -1)
+        assignments.append("state = :state");
+    if (patch.receivingTime.year != -1)
+        assignments.append("receivingDay = :receivingDay");
+    if (!patch.expressman.isEmpty())
+        assignments.append("expressman = :expressman");
+    if (assignments.isEmpty())
+        return false;
+
+    QSqlQuery sqlQuery = preparedQuery("UPDATE item SET " + assignments.join(", ") + " WHERE id = :id");
+    if (patch.state != -1)
+        sqlQuery.bindValue(":state", patch.state);
+    if (patch.receivingTime.year != -1)
+        sqlQuery.bindValue(":receivingDay", patch.receivingTime.toDayNumber());
+    if (!patch.expressman.isEmpty())
+        sqlQuery.bindValue(":expressman", patch.expressman);
+    sqlQuery.bindValue(":id", id);
 
     exec(sqlQuery);
     if (!sqlQuery.exec())
     {
-        qCritical() << "数据库:查找物品失败" << sqlQuery.lastError();
-        return 0;
+        qCritical() << "数据库:修改id为 " << id << " 的物品失败" << sqlQuery.lastError();
+        return false;
     }
-    else
+    if (sqlQuery.numRowsAffected() == 0)
+    {
+        qCritical() << "数据库:不存在id为 " << id << " 的物品";
+        return false;
+    }
+    qDebug() << "数据库:修改id为 " << id << " 的物品成功";
+    if (itemColumns)
+    {
+        itemColumns->modify(id, patch);
+        commitItemColumns();
+    }
+    return true;
+}
+
+int Database::queryItemsByIds(const QVector<int> &ids, const ItemSink &sink) const
+{
+    flushPendingItems();
+    int cnt = 0;
+    for (int begin = 0; begin < ids.size(); begin += BULK_ID_CHUNK)
     {
-        int cnt = 0;
+        int n = std::min(BULK_ID_CHUNK, ids.size() - begin);
+        QSqlQuery sqlQuery(db);
+        sqlQuery.setForwardOnly(true);
+        sqlQuery.prepare("SELECT * FROM item WHERE id IN (" + idPlaceholders(n) + ")");
+        for (int i = 0; i < n; i++)
+            sqlQuery.bindValue(":id" + QString::number(i), ids[begin + i]);
+
+        exec(sqlQuery);
+        if (!sqlQuery.exec())
+        {
+            qCritical() << "数据库:按单号批量查找物品失败" << sqlQuery.lastError();
+            return cnt;
+        }
         while (sqlQuery.next())
         {
-            result.append(query2Item(sqlQuery)); //将查找结果转换为临时Item对象
+            sink(query2Row(sqlQuery));
             cnt++;
         }
-        qDebug() << "数据库:查找物品成功，共" << cnt << "条";
-        return cnt;
     }
+    qDebug() << "数据库:按单号批量查找物品，共" << cnt << "条";
+    return cnt;
 }
 
-bool Database::modifyItemState(const int id, const int state)
+bool Database::modifyItems(const QVector<int> &ids, const ItemPatch &patch)
 {
-    return modifyData("item", QString::number(id), "state", state);
-}
+    flushPendingItems();
+    QStringList assignments;
+    if (patch.state != -1)
+        assignments.append("state = :state");
+    if (patch.receivingTime.year != -1)
+        assignments.append("receivingDay = :receivingDay");
+    if (!patch.expressman.isEmpty())
+        assignments.append("expressman = :expressman");
+    if (assignments.isEmpty() || ids.isEmpty())
+        return false;
 
-bool Database::modifyItemExpressman(const int id, const QString &expressman)
-{
-    return modifyData("item", QString::number(id), "expressman", expressman);
-}
+    //不在一组写入中时自己开一个事务；在一组写入中时用保存点，失败时只撤销前面几块已执行的UPDATE
+    bool ownTransaction = !groupCommitting;
+    if (ownTransaction)
+        db.transaction();
+    else
+        QSqlQuery(db).exec("SAVEPOINT modify_items");
+    for (int begin = 0; begin < ids.size(); begin += BULK_ID_CHUNK)
+    {
+        int n = std::min(BULK_ID_CHUNK, ids.size() - begin);
+        QSqlQuery sqlQuery(db);
+        sqlQuery.prepare("UPDATE item SET " + assignments.join(", ") + " WHERE id IN (" + idPlaceholders(n) + ")");
+        if (patch.state != -1)
+            sqlQuery.bindValue(":state", patch.state);
+        if (patch.receivingTime.year != -1)
+            sqlQuery.bindValue(":receivingDay", patch.receivingTime.toDayNumber());
+        if (!patch.expressman.isEmpty())
+            sqlQuery.bindValue(":expressman", patch.expressman);
+        for (int i = 0; i < n; i++)
+            sqlQuery.bindValue(":id" + QString::number(i), ids[begin + i]);
 
-bool Database::modifyItemReceivingTime(const int id, const Time &receivingTime)
-{
-    bool flag1 = false, flag2 = false, flag3 = false;
-    flag1 = modifyData("item", QString::number(id), "receivingTime_Year", receivingTime.year);
-    flag2 = modifyData("item", QString::number(id), "receivingTime_Month", receivingTime.month);
-    flag3 = modifyData("item", QString::number(id), "receivingTime_Day", receivingTime.day);
-    return flag1 && flag2 && flag3;
+        exec(sqlQuery);
+        bool ok = sqlQuery.exec();
+        if (!ok)
+            qCritical() << "数据库:批量修改物品失败" << sqlQuery.lastError();
+        else if (sqlQuery.numRowsAffected() != n)
+        {
+            qCritical() << "数据库:批量修改时有" << n - sqlQuery.numRowsAffected() << "个物品不存在";
+            ok = false;
+        }
+        if (!ok)
+        {
+            if (ownTransaction)
+                db.rollback();
+            else
+            {
+                QSqlQuery savepointQuery(db);
+                savepointQuery.exec("ROLLBACK TO modify_items");
+                savepointQuery.exec("RELEASE modify_items");
+            }
+            return false;
+        }
+    }
+    if (!ownTransaction)
+        QSqlQuery(db).exec("RELEASE modify_items");
+    else if (!db.commit())
+    {
+        qCritical() << "数据库:批量修改物品提交失败" << db.lastError();
+        db.rollback();
+        return false;
+    }
+    qDebug() << "数据库:批量修改" << ids.size() << "个物品成功";
+    if (itemColumns)
+    {
+        for (int id : ids)
+            itemColumns->modify(id, patch);
+        commitItemColumns();
+    }
+    return true;
 }
 
 bool Database::deleteItem(const int id) const
 {
-    QSqlQuery sqlQuery(db);
-    sqlQuery.prepare("DELETE FROM item WHERE id = :id");
+    flushPendingItems();
+    QSqlQuery sqlQuery = preparedQuery("DELETE FROM item WHERE id = :id");
     sqlQuery.bindValue(":id", id);
     exec(sqlQuery);
-    if (!sqlQuery.exec())
+    bool ok = sqlQuery.exec();
+    if (ok && sqlQuery.numRowsAffected() == 0) //不在item表中时可能已归档
+    {
+        sqlQuery = preparedQuery("DELETE FROM item_archive WHERE id = :id");
+        sqlQuery.bindValue(":id", id);
+        ok = sqlQuery.exec();
+    }
+    if (ok)
+    {
+        sqlQuery = preparedQuery("DELETE FROM item_gram WHERE id = :id");
+        sqlQuery.bindValue(":id", id);
+        ok = sqlQuery.exec();
+    }
+    if (!ok)
     {
         qCritical() << "数据库删除id为 " << id << " 的项失败";
         return false;
@@ -534,44 +1996,114 @@ bool Database::deleteItem(const int id) const
     else
     {
         qDebug() << "数据库删除id为 " << id << " 的项成功";
+        if (itemColumns)
+        {
+            itemColumns->remove(id);
+            commitItemColumns();
+        }
         return true;
     }
 }
 
-bool Database::deleteUser(const QString targetUsername) const
+int Database::archiveItems(int beforeDay, int limit)
+{
+    if (groupCommitting)
+        return 0;
+
+    QSqlQuery sqlQuery = preparedQuery("SELECT id, receivingDay FROM item WHERE state = :state AND receivingDay BETWEEN 0 AND :lastDay ORDER BY id LIMIT :limit");
+    sqlQuery.bindValue(":state", RECEIVED);
+    sqlQuery.bindValue(":lastDay", beforeDay - 1);
+    sqlQuery.bindValue(":limit", limit);
+    if (!sqlQuery.exec())
+    {
+        qCritical() << "数据库:查找待归档的物品失败" << sqlQuery.lastError();
+        return 0;
+    }
+    QVariantList ids;
+    int previousUntil = archivedUntil.loadAcquire();
+    int until = previousUntil;
+    while (sqlQuery.next())
+    {
+        ids.append(sqlQuery.value(0));
+        until = std::max(until, sqlQuery.value(1).toInt());
+    }
+    sqlQuery.finish();
+    if (ids.isEmpty())
+        return 0;
+
+    //提交前先让查询开始读归档表：提交前物品还在item表中，提交后就在归档表中，不会有查不到的时刻
+    archivedUntil.storeRelease(until);
+
+    //复制到归档表再从item表删除，两步在同一个事务中
+    db.transaction();
+    QSqlQuery copyQuery = preparedQuery("INSERT INTO item_archive SELECT * FROM item WHERE id = :id");
+    copyQuery.bindValue(":id", ids);
+    QSqlQuery deleteQuery = preparedQuery("DELETE FROM item WHERE id = :id");
+    deleteQuery.bindValue(":id", ids);
+    if (!copyQuery.execBatch() || !deleteQuery.execBatch() || !db.commit())
+    {
+        qCritical() << "数据库:归档物品失败" << db.lastError();
+        db.rollback();
+        archivedUntil.storeRelease(previousUntil);
+        return 0;
+    }
+    qInfo() << "数据库:归档" << ids.size() << "个已签收的物品";
+    return ids.size();
+}
+
+bool Database::deleteUser(const QString targetUsername, const Time &time)
 {
-    if (!usernameSet.contains(targetUsername))
+    int balance = queryBalanceByName(targetUsername);
+    if (balance == -1)
+    {
+        qCritical() << "数据库删除user " << targetUsername << " 失败:用户不存在";
         return false;
+    }
+
+    //结清余额和删除用户整体成功或整体撤销
+    if (groupCommitting)
+        QSqlQuery(db).exec("SAVEPOINT delete_user");
+    else
+        db.transaction();
 
-    int type, balance;
-    QString username, password, name, phoneNumber, address;
-    char ch;
-    QFile userFile1(userFileName), userFile2("../data/tempUsers.txt");
-    if (!userFile1.open(QIODevice::ReadWrite | QIODevice ::Text))
+    bool ok = true;
+    QSqlQuery sqlQuery(db);
+    if (balance != 0)
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        sqlQuery = preparedQuery("INSERT INTO ledger(srcName, dstName, amount, year, month, day) VALUES(:srcName, '', :amount, :year, :month, :day)");
+        sqlQuery.bindValue(":srcName", targetUsername);
+        sqlQuery.bindValue(":amount", balance);
+        sqlQuery.bindValue(":year", time.year);
+        sqlQuery.bindValue(":month", time.month);
+        sqlQuery.bindValue(":day", time.day);
+        exec(sqlQuery);
+        ok = sqlQuery.exec();
     }
-    if (!userFile2.open(QIODevice::ReadWrite | QIODevice ::Text))
+    if (ok)
     {
-        qCritical() << "user文件打开失败";
-        exit(1);
+        sqlQuery = preparedQuery("DELETE FROM user WHERE username = :username");
+        sqlQuery.bindValue(":username", targetUsername);
+        exec(sqlQuery);
+        ok = sqlQuery.exec() && sqlQuery.numRowsAffected() > 0;
     }
-    QTextStream stream1(&userFile1);
-    QTextStream stream2(&userFile2);
 
-    while (!stream1.atEnd())
+    if (groupCommitting)
     {
-        stream1 >> username >> password >> type >> balance >> name >> phoneNumber >> address;
-        stream1 >> ch; //吃一个回车
-        qDebug() << username << password << type << balance << name << phoneNumber << address;
-        if (username != targetUsername)
-            stream2 << username << " " << password << " " << type << " " << balance << " " << name << " " << phoneNumber << " " << address << Qt::endl;
+        QSqlQuery savepointQuery(db);
+        if (!ok)
+            savepointQuery.exec("ROLLBACK TO delete_user");
+        savepointQuery.exec("RELEASE delete_user");
     }
-    userFile1.close();
-    userFile2.close();
-    QDir dir;
-    dir.remove(userFileName);
-    dir.rename("../data/tempUsers.txt", userFileName);
+    else if (!ok || !db.commit())
+    {
+        ok = false;
+        db.rollback();
+    }
+    if (!ok)
+    {
+        qCritical() << "数据库删除user " << targetUsername << " 失败" << sqlQuery.lastError();
+        return false;
+    }
+    qDebug() << "数据库删除user " << targetUsername << " 成功";
     return true;
 }
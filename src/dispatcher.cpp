@@ -0,0 +1,148 @@
+﻿/**
+ * @file dispatcher.cpp
+ * @author Haolin Yang
+ * @brief 自动派单类的实现
+ * @version 0.1
+ * @date 2022-05-31
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/dispatcher.h"
+#include "../include/database.h"
+
+Dispatcher::Dispatcher(Database *_db, int _policy) : db(_db), policy(_policy)
+{
+    rebuild();
+}
+
+void Dispatcher::rebuild()
+{
+    loads.clear();
+    byLoad.clear();
+    queued.clear();
+    db->queryAllUser([this](const QSharedPointer<User> &user) {
+        if (user->getUserType() == EXPRESSMAN)
+            loads.insert(user->getUsername(), 0);
+    });
+    QHash<QString, QHash<int, int>> counts;
+    db->queryItemCounts(counts);
+    for (auto i = loads.begin(); i != loads.end(); i++)
+    {
+        i.value() = counts.value(i.key()).value(PENDING_COLLECTING);
+        byLoad.insert({i.value(), i.key()});
+    }
+    db->queryItemByFilter([this](const ItemRow &row) { queued.insert(row.id); },
+                          -1, PENDING_COLLECTING, Time(-1, -1, -1), Time(-1, -1, -1), "", "", UNASSIGNED_EXPRESSMAN);
+    seenRollbackCount = db->getRollbackCount();
+    qDebug() << "派单:重建索引，共" << loads.size() << "个快递员，" << queued.size() << "个物品待分配";
+}
+
+void Dispatcher::checkRollback()
+{
+    if (seenRollbackCount != db->getRollbackCount())
+        rebuild();
+}
+
+QString Dispatcher::pick()
+{
+    if (policy == DISPATCH_MANUAL)
+        return UNASSIGNED_EXPRESSMAN;
+    checkRollback();
+    return choose();
+}
+
+QString Dispatcher::choose()
+{
+    if (loads.isEmpty())
+        return UNASSIGNED_EXPRESSMAN;
+    if (policy == DISPATCH_LEAST_LOADED)
+        return byLoad.begin()->second;
+
+    auto next = loads.upperBound(lastPicked);
+    if (next == loads.end())
+        next = loads.begin();
+    lastPicked = next.key();
+    return lastPicked;
+}
+
+QHash<QString, QVector<int>> Dispatcher::planQueued(int limit)
+{
+    QHash<QString, QVector<int>> plan;
+    if (policy == DISPATCH_MANUAL)
+        return plan;
+    checkRollback();
+    if (loads.isEmpty())
+        return plan;
+
+    //计划中的物品先计入负载，让最小负载策略把这一批分散开，最后再减回去
+    int cnt = 0;
+    for (auto i = queued.begin(); i != queued.end() && cnt != limit; i++, cnt++)
+    {
+        QString expressman = choose();
+        plan[expressman].append(*i);
+        adjust(expressman, 1);
+    }
+    for (auto i = plan.constBegin(); i != plan.constEnd(); i++)
+        adjust(i.key(), -i.value().size());
+    return plan;
+}
+
+int Dispatcher::queuedCount() const
+{
+    return int(queued.size());
+}
+
+void Dispatcher::itemInserted(int id, int state, const QString &expressman)
+{
+    if (state != PENDING_COLLECTING)
+        return;
+    if (expressman == UNASSIGNED_EXPRESSMAN)
+        queued.insert(id);
+    else
+        adjust(expressman, 1);
+}
+
+void Dispatcher::itemModified(int id, int state, const QString &expressman, const ItemPatch &patch)
+{
+    itemDeleted(id, state, expressman);
+    itemInserted(id, patch.state != -1 ? patch.state : state, !patch.expressman.isEmpty() ? patch.expressman : expressman);
+}
+
+void Dispatcher::itemDeleted(int id, int state, const QString &expressman)
+{
+    if (state != PENDING_COLLECTING)
+        return;
+    if (expressman == UNASSIGNED_EXPRESSMAN)
+        queued.erase(id);
+    else
+        adjust(expressman, -1);
+}
+
+void Dispatcher::expressmanAdded(const QString &expressman)
+{
+    if (loads.contains(expressman))
+        return;
+    loads.insert(expressman, 0);
+    byLoad.insert({0, expressman});
+}
+
+void Dispatcher::expressmanRemoved(const QString &expressman)
+{
+    auto i = loads.find(expressman);
+    if (i == loads.end())
+        return;
+    byLoad.erase({i.value(), expressman});
+    loads.erase(i);
+}
+
+void Dispatcher::adjust(const QString &expressman, int delta)
+{
+    auto i = loads.find(expressman);
+    if (i == loads.end())
+        return;
+    byLoad.erase({i.value(), expressman});
+    i.value() += delta;
+    byLoad.insert({i.value(), expressman});
+}
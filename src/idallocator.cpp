@@ -0,0 +1,74 @@
+﻿/**
+ * @file idallocator.cpp
+ * @author Haolin Yang
+ * @brief 分块ID分配器类的实现
+ * @version 0.1
+ * @date 2022-05-29
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/idallocator.h"
+#include <QDebug>
+#include <QFile>
+#include <QLockFile>
+#include <QSaveFile>
+#include <algorithm>
+
+IdAllocator::IdAllocator(const QString &_fileName, int _blockSize) : fileName(_fileName), blockSize(_blockSize), generation(0)
+{
+}
+
+int IdAllocator::reserve(int floor, int count)
+{
+    //另一个进程可能正在推进高水位线，等它写完
+    QLockFile lock(fileName + ".lock");
+    if (!lock.lock())
+    {
+        qCritical() << "ID分配器:无法锁定" << fileName << lock.error();
+        return -1;
+    }
+
+    int highWater = 0;
+    QFile file(fileName);
+    if (file.open(QIODevice::ReadOnly))
+        highWater = file.readAll().trimmed().toInt();
+    int first = std::max(highWater, floor) + 1;
+
+    QSaveFile saveFile(fileName);
+    if (!saveFile.open(QIODevice::WriteOnly) || saveFile.write(QByteArray::number(first + count - 1)) == -1 || !saveFile.commit())
+    {
+        qCritical() << "ID分配器:写入高水位线失败" << saveFile.errorString();
+        return -1;
+    }
+    return first;
+}
+
+int IdAllocator::allocate()
+{
+    if (!blocks.hasLocalData())
+        blocks.setLocalData(new Block);
+    Block *block = blocks.localData();
+
+    int current = generation.loadAcquire();
+    if (block->next == block->end || block->generation != current)
+    {
+        QMutexLocker locker(&mutex);
+        int first = reserve(0, blockSize);
+        if (first == -1)
+            return -1;
+        block->next = first;
+        block->end = first + blockSize;
+        block->generation = current;
+        qDebug() << "ID分配器:预留" << first << "~" << block->end - 1;
+    }
+    return block->next++;
+}
+
+bool IdAllocator::raiseTo(int floor)
+{
+    QMutexLocker locker(&mutex);
+    generation.fetchAndAddOrdered(1);
+    return reserve(floor, 0) != -1;
+}
@@ -11,15 +11,55 @@
 
 #include "../include/item.h"
 #include "../include/database.h"
+#include "../include/dispatcher.h"
+#include "../include/stats.h"
 
-void Item::insertInfo2DB(Database *db)
+bool Item::insertInfo2DB(Database *db)
 {
-    db->insertItem(id, cost, type, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+    return db->insertItem(id, cost, type, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
 }
 
-ItemManage::ItemManage(Database *_db) : db(_db)
+void Item::apply(const ItemPatch &patch)
 {
-    total = db->getDBMaxId("item");
+    if (patch.state != -1)
+        state = patch.state;
+    if (patch.receivingTime.year != -1)
+        receivingTime = patch.receivingTime;
+    if (!patch.expressman.isEmpty())
+        expressman = NameTable::intern(patch.expressman);
+}
+
+QSharedPointer<Item> Item::fromRow(const ItemRow &row)
+{
+    switch (row.type)
+    {
+    case FRAGILE:
+        return QSharedPointer<FragileItem>::create(row.id, row.cost, row.state, row.sendingTime(), row.receivingTime(), row.srcName, row.dstName, row.expressman, row.description);
+    case BOOK:
+        return QSharedPointer<Book>::create(row.id, row.cost, row.state, row.sendingTime(), row.receivingTime(), row.srcName, row.dstName, row.expressman, row.description);
+    case NORMAL:
+        return QSharedPointer<NormalItem>::create(row.id, row.cost, row.state, row.sendingTime(), row.receivingTime(), row.srcName, row.dstName, row.expressman, row.description);
+    }
+    return {};
+}
+
+ItemManage::ItemManage(Database *_db, Statistics *_stats, Dispatcher *_dispatcher) : db(_db), stats(_stats), dispatcher(_dispatcher), idAllocator(ITEM_ID_FILE_NAME), itemCache(ITEM_CACHE_SIZE)
+{
+    //高水位线文件丢失或落后时以数据库中最大的单号为准
+    if (!idAllocator.raiseTo(db->getDBMaxId("item")))
+        qCritical() << "物品单号分配器初始化失败";
+    seenRollbackCount = db->getRollbackCount();
+}
+
+void ItemManage::cacheItem(const QSharedPointer<Item> &item) const
+{
+    //数据库回滚过的话，缓存中可能有没写进数据库的修改
+    if (seenRollbackCount != db->getRollbackCount())
+    {
+        itemCache.clear();
+        seenRollbackCount = db->getRollbackCount();
+    }
+    itemCache.insert(item->getId(), new QSharedPointer<Item>(item));
 }
 
 int ItemManage::insertItem(
@@ -34,64 +74,126 @@ int ItemManage::insertItem(
     const QString &description)
 {
     qDebug() << "添加物品 ";
+    int id = idAllocator.allocate();
+    if (id == -1)
+        return -1;
     QSharedPointer<Item> item;
     switch (type)
     {
     case FRAGILE:
-        item = QSharedPointer<FragileItem>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<FragileItem>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     case BOOK:
-        item = QSharedPointer<Book>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<Book>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     case NORMAL:
-        item = QSharedPointer<NormalItem>::create(++total, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
+        item = QSharedPointer<NormalItem>::create(id, cost, state, sendingTime, receivingTime, srcName, dstName, expressman, description);
         break;
     }
-    item->insertInfo2DB(db);
-    return total;
+    if (!item->insertInfo2DB(db))
+        return -1;
+    cacheItem(item);
+    stats->itemInserted(state, expressman);
+    dispatcher->itemInserted(id, state, expressman);
+    return id;
 }
 
-int ItemManage::queryAll(QList<QSharedPointer<Item>> &result) const
+int ItemManage::queryAll(const ItemSink &sink) const
 {
     qDebug() << "查询所有物品";
-    return db->queryItemByFilter(result, -1, -1, Time(-1, -1, -1), Time(-1, -1, -1), "", "", "");
+    return db->queryItemByFilter(sink, -1, -1, Time(-1, -1, -1), Time(-1, -1, -1), "", "", "");
 }
 
-int ItemManage::queryByFilter(QList<QSharedPointer<Item>> &result, const int id, const int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman) const
+int ItemManage::queryByFilter(const ItemSink &sink, const int id, const int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom, const Time &sendingTo, const ItemPage &page, const QString &descriptionContains) const
 {
     qDebug() << "按条件查询";
-    return db->queryItemByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, expressman);
+    return db->queryItemByFilter(sink, id, state, sendingTime, receivingTime, srcName, dstName, expressman, sendingFrom, sendingTo, page, descriptionContains);
 }
 
 bool ItemManage::queryById(QSharedPointer<Item> &result, const int id) const
 {
-    QList<QSharedPointer<Item>> temp;
+    if (seenRollbackCount == db->getRollbackCount())
+    {
+        QSharedPointer<Item> *cached = itemCache.object(id);
+        if (cached)
+        {
+            result = *cached;
+            return true;
+        }
+    }
+
+    QVector<ItemRow> temp;
     if (db->queryItemByFilter(temp, id, -1, Time(-1, -1, -1), Time(-1, -1, -1), "", "", ""))
     {
-        result = temp[0];
+        result = Item::fromRow(temp[0]);
+        cacheItem(result);
         return true;
     }
     else
         return false;
 }
 
-bool ItemManage::modifyState(const int id, const int state)
+bool ItemManage::modify(const int id, const ItemPatch &patch)
+{
+    QSharedPointer<Item> before;
+    if (!queryById(before, id) || !db->modifyItem(id, patch))
+    {
+        itemCache.remove(id);
+        return false;
+    }
+    stats->itemModified(*before, patch);
+    dispatcher->itemModified(id, before->getState(), before->getExpressman(), patch);
+    QSharedPointer<Item> *cached = itemCache.object(id);
+    if (cached)
+        (*cached)->apply(patch);
+    return true;
+}
+
+int ItemManage::queryByIds(const QVector<int> &ids, QVector<ItemRow> &result) const
 {
-    return db->modifyItemState(id, state);
+    qDebug() << "按单号批量查询" << ids.size() << "个物品";
+    return db->queryItemsByIds(ids, [&result](const ItemRow &row) { result.append(row); });
 }
 
-bool ItemManage::modifyReceivingTime(const int id, const Time &receivingTime)
+bool ItemManage::modifyBatch(const QVector<ItemRow> &before, const ItemPatch &patch)
 {
-    return db->modifyItemReceivingTime(id, receivingTime);
+    QVector<int> ids;
+    ids.reserve(before.size());
+    for (const ItemRow &row : before)
+        ids.append(row.id);
+    if (!db->modifyItems(ids, patch))
+    {
+        for (int id : ids)
+            itemCache.remove(id);
+        return false;
+    }
+    for (const ItemRow &row : before)
+    {
+        stats->itemModified(row.state, row.expressman, patch);
+        dispatcher->itemModified(row.id, row.state, row.expressman, patch);
+        QSharedPointer<Item> *cached = itemCache.object(row.id);
+        if (cached)
+            (*cached)->apply(patch);
+    }
+    return true;
 }
 
-bool ItemManage::modifyExpressman(const int id, const QString &expressman)
+void ItemManage::reload()
 {
-    return db->modifyItemExpressman(id, expressman);
+    idAllocator.raiseTo(db->getDBMaxId("item"));
+    itemCache.clear();
 }
 
 bool ItemManage::deleteItem(const int id) const
 {
     qDebug() << "删除id为" << id << "的物品";
-    return db->deleteItem(id);
+    QSharedPointer<Item> before;
+    if (!queryById(before, id))
+        return false;
+    itemCache.remove(id);
+    if (!db->deleteItem(id))
+        return false;
+    stats->itemDeleted(*before);
+    dispatcher->itemDeleted(id, before->getState(), before->getExpressman());
+    return true;
 }
\ No newline at end of file
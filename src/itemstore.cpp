@@ -0,0 +1,324 @@
+﻿/**
+ * @file itemstore.cpp
+ * @author Haolin Yang
+ * @brief 列式物品副本类的实现
+ * @version 0.1
+ * @date 2022-05-27
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/itemstore.h"
+#include <QDebug>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    /**
+     * @brief 按范围条件筛选
+     * @param selection 选择掩码
+     * @param column 列
+     * @param n 行数
+     * @param first 下限(含)
+     * @param last 上限(含)
+     */
+    void filterRange(quint8 *selection, const int *column, int n, int first, int last)
+    {
+        for (int i = 0; i < n; i++)
+            selection[i] &= (column[i] >= first) & (column[i] <= last);
+    }
+
+    /**
+     * @brief 按日期条件筛选，规则与数据库中的日序号查询相同
+     * @param selection 选择掩码
+     * @param column 日序号列
+     * @param n 行数
+     * @param time 要查询的时间，未设置的部分为-1
+     */
+    void filterDays(quint8 *selection, const int *column, int n, const Time &time)
+    {
+        if (time.year != -1)
+            filterRange(selection, column, n, time.firstDayNumber(), time.lastDayNumber());
+        else if (time.month != -1)
+        {
+            int month = time.month;
+            for (int i = 0; i < n; i++)
+                selection[i] &= (column[i] >= 0) & (column[i] % 372 / 31 + 1 == month);
+        }
+        if (time.day != -1 && !(time.year != -1 && time.month != -1))
+        {
+            int day = time.day;
+            for (int i = 0; i < n; i++)
+                selection[i] &= (column[i] >= 0) & (column[i] % 31 + 1 == day);
+        }
+    }
+
+    /**
+     * @brief 按相等条件筛选
+     * @param selection 选择掩码
+     * @param column 列
+     * @param n 行数
+     * @param value 要查询的值
+     */
+    void filterEquals(quint8 *selection, const int *column, int n, int value)
+    {
+        for (int i = 0; i < n; i++)
+            selection[i] &= (column[i] == value);
+    }
+
+    /**
+     * @brief 截断一列并释放多余的容量
+     * @param column 列
+     * @param n 保留的行数
+     */
+    template <typename T>
+    void shrink(QVector<T> &column, int n)
+    {
+        column.resize(n);
+        column.squeeze();
+    }
+}
+
+void ColumnItemStore::insert(int id, int cost, int type, int state, int sendingDay, int receivingDay, const QString &srcName, const QString &dstName, const QString &expressman, const QString &description)
+{
+    pending.append([=]() {
+        int row = std::lower_bound(ids.begin(), ids.end(), id) - ids.begin();
+        if (row < ids.size() && ids[row] == id && alive[row])
+        {
+            qWarning() << "列式副本:单号" << id << "已存在";
+            return;
+        }
+        if (row < ids.size() && ids[row] == id) //还没压缩掉的已删除行，原地复用
+        {
+            costs[row] = cost;
+            types[row] = type;
+            states[row] = state;
+            sendingDays[row] = sendingDay;
+            receivingDays[row] = receivingDay;
+            srcNames[row] = encode(srcName);
+            dstNames[row] = encode(dstName);
+            expressmen[row] = encode(expressman);
+            descriptions[row] = description;
+            alive[row] = 1;
+            aliveCount++;
+            return;
+        }
+        //单号递增分配，几乎总是追加在末尾
+        ids.insert(row, id);
+        costs.insert(row, cost);
+        types.insert(row, type);
+        states.insert(row, state);
+        sendingDays.insert(row, sendingDay);
+        receivingDays.insert(row, receivingDay);
+        srcNames.insert(row, encode(srcName));
+        dstNames.insert(row, encode(dstName));
+        expressmen.insert(row, encode(expressman));
+        descriptions.insert(row, description);
+        alive.insert(row, 1);
+        aliveCount++;
+    });
+}
+
+void ColumnItemStore::modify(int id, const ItemPatch &patch)
+{
+    pending.append([=]() {
+        int row = rowOf(id);
+        if (row == -1)
+            return;
+        if (patch.state != -1)
+            states[row] = patch.state;
+        if (patch.receivingTime.year != -1)
+            receivingDays[row] = patch.receivingTime.toDayNumber();
+        if (!patch.expressman.isEmpty())
+            expressmen[row] = encode(patch.expressman);
+    });
+}
+
+void ColumnItemStore::remove(int id)
+{
+    pending.append([=]() {
+        int row = rowOf(id);
+        if (row == -1)
+            return;
+        alive[row] = 0;
+        aliveCount--;
+    });
+}
+
+void ColumnItemStore::commit()
+{
+    if (pending.isEmpty())
+        return;
+    QWriteLocker locker(&lock);
+    for (const std::function<void()> &apply : pending)
+        apply();
+    pending.clear();
+    int dead = ids.size() - aliveCount;
+    if (dead >= COLUMN_COMPACT_MIN_DEAD && dead * 4 > ids.size())
+        compact();
+}
+
+void ColumnItemStore::rollback()
+{
+    pending.clear();
+}
+
+void ColumnItemStore::rollbackTo(int mark)
+{
+    if (mark < pending.size())
+        pending.resize(mark);
+}
+
+int ColumnItemStore::size() const
+{
+    QReadLocker locker(&lock);
+    return aliveCount;
+}
+
+void ColumnItemStore::compact()
+{
+    int dead = ids.size() - aliveCount;
+    QVector<QString> usedNames;
+    QHash<QString, int> usedCodes;
+    auto recode = [&](int code) {
+        const QString &name = names[code];
+        auto i = usedCodes.constFind(name);
+        if (i != usedCodes.constEnd())
+            return i.value();
+        usedNames.append(name);
+        usedCodes.insert(name, usedNames.size() - 1);
+        return usedNames.size() - 1;
+    };
+
+    //保留的行依次前移，行的相对顺序不变，单号仍然升序
+    int n = 0;
+    for (int row = 0; row < ids.size(); row++)
+    {
+        if (!alive[row])
+            continue;
+        ids[n] = ids[row];
+        costs[n] = costs[row];
+        types[n] = types[row];
+        states[n] = states[row];
+        sendingDays[n] = sendingDays[row];
+        receivingDays[n] = receivingDays[row];
+        srcNames[n] = recode(srcNames[row]);
+        dstNames[n] = recode(dstNames[row]);
+        expressmen[n] = recode(expressmen[row]);
+        descriptions[n] = descriptions[row];
+        alive[n] = 1;
+        n++;
+    }
+    shrink(ids, n);
+    shrink(costs, n);
+    shrink(types, n);
+    shrink(states, n);
+    shrink(sendingDays, n);
+    shrink(receivingDays, n);
+    shrink(srcNames, n);
+    shrink(dstNames, n);
+    shrink(expressmen, n);
+    shrink(descriptions, n);
+    shrink(alive, n);
+    names.swap(usedNames);
+    nameCodes.swap(usedCodes);
+    qDebug() << "列式副本:压缩掉" << dead << "个已删除的行，剩余" << n << "行";
+}
+
+int ColumnItemStore::encode(const QString &name)
+{
+    auto i = nameCodes.constFind(name);
+    if (i != nameCodes.constEnd())
+        return i.value();
+    names.append(NameTable::intern(name));
+    nameCodes.insert(name, names.size() - 1);
+    return names.size() - 1;
+}
+
+int ColumnItemStore::rowOf(int id) const
+{
+    int row = std::lower_bound(ids.begin(), ids.end(), id) - ids.begin();
+    if (row == ids.size() || ids[row] != id || !alive[row])
+        return -1;
+    return row;
+}
+
+int ColumnItemStore::query(const ItemSink &sink, int id, int state, const Time &sendingTime, const Time &receivingTime, const QString &srcName, const QString &dstName, const QString &expressman, const Time &sendingFrom, const Time &sendingTo, const ItemPage &page) const
+{
+    if (page.orderBy != ORDER_BY_ID)
+        return -1;
+
+    QReadLocker locker(&lock);
+
+    //单号条件和分页游标直接缩小扫描的行范围
+    int begin = 0, end = ids.size();
+    if (id != -1)
+    {
+        begin = rowOf(id);
+        if (begin == -1)
+            return 0;
+        end = begin + 1;
+    }
+    if (page.afterId != -1)
+        begin = std::max(begin, int(std::upper_bound(ids.begin(), ids.end(), page.afterId) - ids.begin()));
+    if (begin >= end)
+        return 0;
+
+    //用户名先换成编码，字典中没有的用户名不会匹配任何物品
+    int codes[3] = {-1, -1, -1};
+    const QString *targets[3] = {&srcName, &dstName, &expressman};
+    for (int k = 0; k < 3; k++)
+    {
+        if (targets[k]->isEmpty())
+            continue;
+        auto i = nameCodes.constFind(*targets[k]);
+        if (i == nameCodes.constEnd())
+            return 0;
+        codes[k] = i.value();
+    }
+
+    int first = sendingFrom.year != -1 ? sendingFrom.firstDayNumber() : std::numeric_limits<int>::min();
+    int last = sendingTo.year != -1 ? sendingTo.lastDayNumber() : std::numeric_limits<int>::max();
+
+    //分块扫描，分页时凑满一页就停止
+    int cnt = 0, scanned = 0;
+    QVector<quint8> selection(COLUMN_SCAN_CHUNK);
+    for (int chunk = begin; chunk < end && cnt != page.limit; chunk += COLUMN_SCAN_CHUNK)
+    {
+        int n = std::min(COLUMN_SCAN_CHUNK, end - chunk);
+        quint8 *sel = selection.data();
+        std::copy(alive.constData() + chunk, alive.constData() + chunk + n, sel);
+        if (state != -1)
+            filterEquals(sel, states.constData() + chunk, n, state);
+        filterDays(sel, sendingDays.constData() + chunk, n, sendingTime);
+        filterDays(sel, receivingDays.constData() + chunk, n, receivingTime);
+        if (sendingFrom.year != -1 || sendingTo.year != -1)
+            filterRange(sel, sendingDays.constData() + chunk, n, first, last);
+        if (codes[0] != -1)
+            filterEquals(sel, srcNames.constData() + chunk, n, codes[0]);
+        if (codes[1] != -1)
+            filterEquals(sel, dstNames.constData() + chunk, n, codes[1]);
+        if (codes[2] != -1)
+            filterEquals(sel, expressmen.constData() + chunk, n, codes[2]);
+        scanned += n;
+
+        for (int i = 0; i < n && cnt != page.limit; i++)
+        {
+            if (sel[i])
+            {
+                emitRow(sink, chunk + i);
+                cnt++;
+            }
+        }
+    }
+    qDebug() << "列式副本:扫描" << scanned << "行，查到" << cnt << "条";
+    return cnt;
+}
+
+void ColumnItemStore::emitRow(const ItemSink &sink, int row) const
+{
+    sink({ids[row], costs[row], types[row], states[row], sendingDays[row], receivingDays[row],
+          names[srcNames[row]], names[dstNames[row]], names[expressmen[row]], descriptions[row]});
+}
@@ -0,0 +1,50 @@
+﻿/**
+ * @file nametable.cpp
+ * @author Haolin Yang
+ * @brief 用户名驻留表类的实现
+ * @version 0.1
+ * @date 2022-05-30
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/nametable.h"
+
+QReadWriteLock NameTable::lock;
+QSet<QString> NameTable::names;
+int NameTable::purgeSize = NAME_TABLE_MIN_PURGE_SIZE;
+
+QString NameTable::intern(const QString &name)
+{
+    if (name.isEmpty())
+        return name;
+    {
+        QReadLocker locker(&lock);
+        auto i = names.constFind(name);
+        if (i != names.constEnd())
+            return *i;
+    }
+    QWriteLocker locker(&lock);
+    if (names.size() >= purgeSize)
+        purge();
+    return *names.insert(name);
+}
+
+void NameTable::purge()
+{
+    for (auto i = names.begin(); i != names.end();)
+    {
+        if (i->isDetached()) //引用计数为1，只有表本身持有
+            i = names.erase(i);
+        else
+            i++;
+    }
+    purgeSize = qMax(NAME_TABLE_MIN_PURGE_SIZE, names.size() * 2);
+}
+
+int NameTable::size()
+{
+    QReadLocker locker(&lock);
+    return names.size();
+}
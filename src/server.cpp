@@ -10,13 +10,40 @@
  */
 #include <QNetworkDatagram>
 #include <QJsonDocument>
+#include <QFutureWatcher>
+#include <QSettings>
+#include <QtConcurrent>
 
 #include "../include/server.h"
 
-Server::Server(QObject *parent, quint16 port, UserManage *_usermanage) : QObject(parent), userManage(_usermanage), socket(this)
+Server::Server(QObject *parent, quint16 port, UserManage *_usermanage, Database *_db) : QObject(parent), userManage(_usermanage), db(_db), socket(this), groupCommitTimer(this), archiveTimer(this)
 {
     socket.bind(QHostAddress::LocalHost, port);
     QObject::connect(&socket, &QUdpSocket::readyRead, this, &Server::messageHandler);
+
+    groupCommitTimer.setSingleShot(true);
+    groupCommitTimer.setInterval(GROUP_COMMIT_WINDOW_MS);
+    QObject::connect(&groupCommitTimer, &QTimer::timeout, this, &Server::flushGroupCommit);
+
+    //每个线程使用一个数据库只读连接，线程常驻以免反复打开连接
+    QSettings settings(SETTINGS_FILE_NAME, QSettings::IniFormat);
+    queryPool.setMaxThreadCount(settings.value("server/queryThreads", QThread::idealThreadCount()).toInt());
+    queryPool.setExpiryTimeout(-1);
+
+    archiveAgeDays = settings.value("archive/ageDays", ARCHIVE_AGE_DAYS).toInt();
+    archiveBatchSize = settings.value("archive/batchSize", ARCHIVE_BATCH_SIZE).toInt();
+    if (archiveAgeDays > 0)
+    {
+        archiveTimer.setInterval(settings.value("archive/intervalMs", ARCHIVE_INTERVAL_MS).toInt());
+        QObject::connect(&archiveTimer, &QTimer::timeout, this, &Server::archiveItems);
+        archiveTimer.start();
+    }
+}
+
+Server::~Server()
+{
+    queryPool.waitForDone();
+    flushGroupCommit();
 }
 
 void Server::messageHandler()
@@ -33,6 +60,24 @@ void Server::messageHandler()
 
         qDebug() << "收到报文，类型为" << type;
 
+        if (type == query) //只读请求，不参与组提交
+        {
+            startQuery(payload, datagram.senderAddress(), datagram.senderPort());
+            continue;
+        }
+
+        if (type == importData || type == exportData) //批量导入导出自己分批提交，先提交之前攒下的写入
+        {
+            flushGroupCommit();
+            res = type == importData ? importDataHandler(payload) : exportDataHandler(payload);
+            if (socket.writeDatagram(res, datagram.senderAddress(), datagram.senderPort()) == -1)
+                qCritical() << "UDP socket出错";
+            continue;
+        }
+
+        db->beginGroupCommit();
+        db->beginRequest();
+
         switch (type)
         {
         case time:
@@ -74,9 +119,6 @@ void Server::messageHandler()
         case addBalance:
             res = addBalanceHandler(payload);
             break;
-        case query:
-            res = queryHandler(payload);
-            break;
         case send:
             res = sendHandler(payload);
             break;
@@ -86,14 +128,81 @@ void Server::messageHandler()
         case deleteItem:
             res = deleteItemHandler(payload);
             break;
+        case history:
+            res = historyHandler(payload);
+            break;
+        case stats:
+            res = statsHandler(payload);
+            break;
+        case assignBatch:
+            res = assignBatchHandler(payload);
+            break;
+        case deliveryBatch:
+            res = deliveryBatchHandler(payload);
+            break;
+        case receiveBatch:
+            res = receiveBatchHandler(payload);
+            break;
         default:
             break;
         }
 
-        qint64 status = socket.writeDatagram(res, datagram.senderAddress(), datagram.senderPort());
+        bool wrote;
+        if (!db->endRequest(wrote)) //只有这个请求被撤销，同组的其他请求不受影响
+        {
+            QJsonObject ret;
+            constructRet(ret, "数据库写入失败");
+            res = QJsonDocument(ret).toJson(QJsonDocument::Compact);
+        }
+        userManage->checkRollback();
+
+        pendingReplies.append({res, datagram.senderAddress(), datagram.senderPort(), wrote});
+        if (pendingReplies.size() >= GROUP_COMMIT_BATCH_SIZE)
+            flushGroupCommit();
+    }
+
+    if (!pendingReplies.isEmpty() && !groupCommitTimer.isActive())
+        groupCommitTimer.start();
+}
+
+void Server::flushGroupCommit()
+{
+    groupCommitTimer.stop();
+    if (!db->commitGroupCommit())
+    {
+        QJsonObject ret;
+        constructRet(ret, "数据库写入失败");
+        for (PendingReply &reply : pendingReplies)
+            if (reply.wrote)
+                reply.data = QJsonDocument(ret).toJson(QJsonDocument::Compact);
+        userManage->checkRollback();
+    }
+
+    for (const PendingReply &reply : pendingReplies)
+    {
+        qint64 status = socket.writeDatagram(reply.data, reply.address, reply.port);
         if (status == -1)
             qCritical() << "UDP socket出错";
     }
+    pendingReplies.clear();
+}
+
+void Server::archiveItems()
+{
+    flushGroupCommit();
+    int today = Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay()).toDayNumber();
+    db->archiveItems(today - archiveAgeDays, archiveBatchSize);
+}
+
+void Server::startQuery(const QJsonObject &payload, const QHostAddress &address, quint16 port)
+{
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    QObject::connect(watcher, &QFutureWatcher<QByteArray>::finished, this, [this, watcher, address, port]() {
+        if (socket.writeDatagram(watcher->result(), address, port) == -1)
+            qCritical() << "UDP socket出错";
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&queryPool, [this, payload]() { return queryHandler(payload); }));
 }
 
 QString Server::jwtEncoding(const QJsonObject &payload, const QByteArray &secret) const
@@ -346,8 +455,11 @@ QByteArray Server::queryHandler(const QJsonObject &payload) const
         QJsonObject filter(payload);
         filter.remove("token");
         QJsonArray result;
-        auto response = userManage->queryItem(jwtGetPayload(payload["token"].toString()), filter, result);
+        QString cursor;
+        auto response = userManage->queryItem(jwtGetPayload(payload["token"].toString()), filter, result, cursor);
         constructRet(ret, response, result);
+        if (response.isEmpty() && !cursor.isEmpty())
+            ret.insert("cursor", cursor);
     }
     return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
 }
@@ -393,3 +505,100 @@ QByteArray Server::deleteItemHandler(const QJsonObject &payload) const
     }
     return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
 }
+
+QByteArray Server::historyHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret))
+        constructRet(ret);
+    else
+    {
+        QJsonObject info(payload);
+        info.remove("token");
+        QJsonArray result;
+        QString response = userManage->queryHistory(jwtGetPayload(payload["token"].toString()), info, result);
+        constructRet(ret, response, result);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::statsHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret))
+        constructRet(ret);
+    else
+    {
+        QJsonObject result;
+        QString response = userManage->queryStats(jwtGetPayload(payload["token"].toString()), result);
+        constructRet(ret, response, result);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::importDataHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret) || !payload.contains("table") || !payload.contains("file"))
+        constructRet(ret);
+    else
+    {
+        int count = 0;
+        QString response = userManage->importData(jwtGetPayload(payload["token"].toString()), payload["table"].toString(), payload["file"].toString(), count);
+        constructRet(ret, response, count);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::exportDataHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret) || !payload.contains("table") || !payload.contains("file"))
+        constructRet(ret);
+    else
+    {
+        int count = 0;
+        QString response = userManage->exportData(jwtGetPayload(payload["token"].toString()), payload["table"].toString(), payload["file"].toString(), count);
+        constructRet(ret, response, count);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::assignBatchHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret) || !payload.contains("expressman") || !payload["itemIds"].isArray())
+        constructRet(ret);
+    else
+    {
+        QString response = userManage->assignItems(jwtGetPayload(payload["token"].toString()), payload["itemIds"].toArray(), payload["expressman"].toString());
+        constructRet(ret, response);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::deliveryBatchHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret) || !payload["itemIds"].isArray())
+        constructRet(ret);
+    else
+    {
+        QString response = userManage->deliveryItems(jwtGetPayload(payload["token"].toString()), payload["itemIds"].toArray());
+        constructRet(ret, response);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
+
+QByteArray Server::receiveBatchHandler(const QJsonObject &payload) const
+{
+    QJsonObject ret;
+    if (!payload.contains("token") || !jwtVerify(payload["token"].toString(), secret) || !payload["itemIds"].isArray())
+        constructRet(ret);
+    else
+    {
+        QString response = userManage->receiveItems(jwtGetPayload(payload["token"].toString()), payload["itemIds"].toArray());
+        constructRet(ret, response);
+    }
+    return QByteArray(QJsonDocument(ret).toJson(QJsonDocument::Compact));
+}
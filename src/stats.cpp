@@ -0,0 +1,111 @@
+﻿/**
+ * @file stats.cpp
+ * @author Haolin Yang
+ * @brief 统计数据类的实现
+ * @version 0.1
+ * @date 2022-05-28
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "../include/stats.h"
+#include "../include/database.h"
+#include <QJsonArray>
+
+Statistics::Statistics(Database *_db) : db(_db)
+{
+    rebuild();
+}
+
+void Statistics::rebuild() const
+{
+    itemsByState.clear();
+    revenueByDay.clear();
+    workloadByExpressman.clear();
+    db->queryItemCounts(workloadByExpressman);
+    for (auto i = workloadByExpressman.constBegin(); i != workloadByExpressman.constEnd(); i++)
+        for (auto j = i.value().constBegin(); j != i.value().constEnd(); j++)
+            itemsByState[j.key()] += j.value();
+    db->queryDailyNetIncome(revenueByDay, "admin");
+    seenRollbackCount = db->getRollbackCount();
+    qDebug() << "统计:重建计数器";
+}
+
+void Statistics::count(int state, const QString &expressman, int delta)
+{
+    itemsByState[state] += delta;
+    workloadByExpressman[expressman][state] += delta;
+}
+
+void Statistics::itemInserted(int state, const QString &expressman)
+{
+    count(state, expressman, 1);
+}
+
+void Statistics::itemModified(const Item &item, const ItemPatch &patch)
+{
+    itemModified(item.getState(), item.getExpressman(), patch);
+}
+
+void Statistics::itemModified(int state, const QString &expressman, const ItemPatch &patch)
+{
+    count(state, expressman, -1);
+    count(patch.state != -1 ? patch.state : state, !patch.expressman.isEmpty() ? patch.expressman : expressman, 1);
+}
+
+void Statistics::itemDeleted(const Item &item)
+{
+    count(item.getState(), item.getExpressman(), -1);
+}
+
+void Statistics::transferred(const QString &srcName, const QString &dstName, int amount, const Time &time)
+{
+    if (dstName == "admin")
+        revenueByDay[time.toDayNumber()] += amount;
+    if (srcName == "admin")
+        revenueByDay[time.toDayNumber()] -= amount;
+}
+
+void Statistics::toJson(QJsonObject &ret) const
+{
+    //数据库回滚过的话，计数器中可能有没写进数据库的修改
+    if (seenRollbackCount != db->getRollbackCount())
+        rebuild();
+
+    int total = 0;
+    QJsonObject states;
+    for (auto i = itemsByState.constBegin(); i != itemsByState.constEnd(); i++)
+    {
+        states.insert(QString::number(i.key()), i.value());
+        total += i.value();
+    }
+
+    QJsonArray revenue;
+    for (auto i = revenueByDay.constBegin(); i != revenueByDay.constEnd(); i++)
+    {
+        Time day = Time::fromDayNumber(i.key());
+        QJsonObject dayJson;
+        dayJson.insert("year", day.year);
+        dayJson.insert("month", day.month);
+        dayJson.insert("day", day.day);
+        dayJson.insert("amount", i.value());
+        revenue.append(dayJson);
+    }
+
+    QJsonObject workload;
+    for (auto i = workloadByExpressman.constBegin(); i != workloadByExpressman.constEnd(); i++)
+    {
+        QJsonObject expressmanStates;
+        for (auto j = i.value().constBegin(); j != i.value().constEnd(); j++)
+            if (j.value())
+                expressmanStates.insert(QString::number(j.key()), j.value());
+        if (!expressmanStates.isEmpty())
+            workload.insert(i.key(), expressmanStates);
+    }
+
+    ret.insert("total", total);
+    ret.insert("state", states);
+    ret.insert("revenue", revenue);
+    ret.insert("workload", workload);
+}
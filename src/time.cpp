@@ -65,5 +65,36 @@ bool Time::isDue() const
 bool Time::isFuture() const
 {
     return ((year > curYear) || (year == curYear && month > curMonth) || (year == curYear && month == curMonth && day >= curDay));
+}
+
+int Time::toDayNumber() const
+{
+    if (year == -1 || month == -1 || day == -1)
+        return -1;
+    return year * 372 + (month - 1) * 31 + (day - 1);
+}
 
+int Time::firstDayNumber() const
+{
+    if (year == -1)
+        return -1;
+    if (month == -1)
+        return year * 372;
+    return year * 372 + (month - 1) * 31 + (day == -1 ? 0 : day - 1);
+}
+
+int Time::lastDayNumber() const
+{
+    if (year == -1)
+        return -1;
+    if (month == -1)
+        return year * 372 + 371;
+    return year * 372 + (month - 1) * 31 + (day == -1 ? 30 : day - 1);
+}
+
+Time Time::fromDayNumber(int dayNumber)
+{
+    if (dayNumber < 0)
+        return Time(-1, -1, -1);
+    return Time(dayNumber / 372, dayNumber % 372 / 31 + 1, dayNumber % 31 + 1);
 }
\ No newline at end of file
@@ -10,11 +10,16 @@
  */
 
 #include "../include/user.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QSettings>
+#include <algorithm>
 #include <string>
 
-void User::insertInfo2DB(Database *db)
+bool User::insertInfo2DB(Database *db)
 {
-    db->insertUser(username, password, type, 0, name, phoneNumber, address);
+    return db->insertUser(username, password, type, 0, name, phoneNumber, address);
 }
 
 QString UserManage::verify(const QJsonObject &token) const
@@ -49,8 +54,13 @@ QString UserManage::addBalance(const QJsonObject &token, int addend) const
     if (userMap[username]->getBalance() + addend > (int)1e9)
         return "余额上限为1000000000";
 
+    //正数为充值，负数为提现
+    Time now(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay());
+    bool ok = addend >= 0 ? db->transferBalance("", username, addend, now) : db->transferBalance(username, "", -addend, now);
+    if (!ok)
+        return "修改余额失败";
+
     qDebug() << "修改用户 " << username << " 成功, 余额为 " << userMap[username]->getBalance() + addend;
-    db->modifyUserBalance(username, userMap[username]->getBalance() + addend);
     userMap[username]->addBalance(addend);
     return {};
 }
@@ -60,37 +70,166 @@ QString UserManage::transferBalance(const QJsonObject &token, int balance, const
     if (balance >= (int)1e9 || balance <= (int)-1e9)
         return "单次余额改变量不能超过1000000000";
 
-    if (!db->queryUserByName(dstUser))
-        return "无法查到另一个用户" + dstUser;
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+
+    if (userMap[username]->getBalance() - balance < 0)
+        return "余额不能为负";
+
+    if (userMap[username]->getBalance() - balance > (int)1e9)
+        return "余额上限为1000000000";
 
     int dstBalance = db->queryBalanceByName(dstUser);
+    if (dstBalance == -1)
+        return "无法查到另一个用户" + dstUser;
+
     if (dstBalance + balance >= (int)1e9)
         return "对方余额不能大于1000000000";
 
     if (dstBalance + balance < 0)
         return "对方余额不能小于0";
 
-    QString ret = addBalance(token, -balance);
-    if (!ret.isEmpty())
-        return ret;
+    //转移余额量为负时，反过来由对方向该用户转账
+    Time now(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay());
+    bool ok = balance >= 0 ? db->transferBalance(username, dstUser, balance, now) : db->transferBalance(dstUser, username, -balance, now);
+    if (!ok)
+        return "转账失败";
+    if (balance >= 0)
+        stats->transferred(username, dstUser, balance, now);
+    else
+        stats->transferred(dstUser, username, -balance, now);
 
-    db->modifyUserBalance(dstUser, dstBalance + balance);
+    userMap[username]->addBalance(-balance);
+    if (userMap.contains(dstUser))
+        userMap[dstUser]->addBalance(balance);
     qDebug() << dstUser << "获得金额: " << balance;
     return {};
 }
 
-QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret) const
+QString UserManage::queryHistory(const QJsonObject &token, const QJsonObject &info, QJsonArray &ret) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+
+    if (info.contains("username") && info["username"].toString() != username)
+    {
+        if (userMap[username]->getUserType() != ADMINISTRATOR)
+            return "非管理员不能查看其他用户的账目";
+        username = info["username"].toString();
+    }
+
+    QList<LedgerEntry> result;
+    db->queryLedgerByName(result, username);
+
+    for (const LedgerEntry &entry : result)
+    {
+        QJsonObject entryJson;
+        entryJson.insert("id", entry.id);
+        entryJson.insert("srcName", entry.srcName);
+        entryJson.insert("dstName", entry.dstName);
+        entryJson.insert("amount", entry.amount);
+        entryJson.insert("year", entry.time.year);
+        entryJson.insert("month", entry.time.month);
+        entryJson.insert("day", entry.time.day);
+        ret.append(entryJson);
+    }
+    return {};
+}
+
+QString UserManage::queryStats(const QJsonObject &token, QJsonObject &ret) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != ADMINISTRATOR)
+        return "非管理员不能查看统计数据";
+
+    stats->toJson(ret);
+    return {};
+}
+
+QString UserManage::importData(const QJsonObject &token, const QString &table, const QString &fileName, int &count) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != ADMINISTRATOR)
+        return "非管理员不能导入数据";
+    if (table != "item" && table != "user")
+        return "只能导入item或user";
+
+    QString path;
+    if (!resolveDataFile(fileName, path))
+        return "文件必须在数据目录中";
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return "无法打开文件" + fileName;
+    if (file.size() > ONLINE_IMPORT_MAX_BYTES) //大文件会长时间占住服务器线程
+        return "文件过大，请停服后使用--import-" + table + "s离线导入";
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+
+    if (table == "item")
+    {
+        count = db->importItems(in);
+        itemManage->reload();
+        stats->rebuild();
+    }
+    else
+        count = db->importUsers(in);
+    dispatcher->rebuild();
+    if (count == -1)
+        return "导入失败";
+    return {};
+}
+
+QString UserManage::exportData(const QJsonObject &token, const QString &table, const QString &fileName, int &count) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != ADMINISTRATOR)
+        return "非管理员不能导出数据";
+    if (table != "item" && table != "user")
+        return "只能导出item或user";
+
+    if (db->countRows(table) > ONLINE_EXPORT_MAX_ROWS) //大表会长时间占住服务器线程
+        return "数据过多，请使用--export-" + table + "s离线导出";
+
+    QString path;
+    if (!resolveDataFile(fileName, path))
+        return "文件必须在数据目录中";
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return "无法打开文件" + fileName;
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+
+    count = table == "item" ? db->exportItems(out) : db->exportUsers(out);
+    out.flush();
+    if (count == -1)
+        return "导出失败";
+    return {};
+}
+
+QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filter, QJsonArray &ret, QString &cursor) const
 {
     bool ok;
     if (!filter.contains("type"))
         return "缺少type键";
     int cnt;
 
-    QString username = verify(token);
-    if (filter["type"].toInt() == 0 && userMap[username]->getUserType() != ADMINISTRATOR)
-        return "非管理员不能查看所有物品";
-
-    QList<QSharedPointer<Item>> result;
+    QString username;
+    {
+        QReadLocker locker(&userMapLock);
+        username = verify(token);
+        if (username.isEmpty())
+            return "验证失败";
+        if (filter["type"].toInt() == 0 && userMap[username]->getUserType() != ADMINISTRATOR)
+            return "非管理员不能查看所有物品";
+    }
 
     int id = -1, state = -1;
     Time sendingTime(-1, -1, -1), receivingTime(-1, -1, -1);
@@ -117,44 +256,101 @@ QString UserManage::queryItem(const QJsonObject &token, const QJsonObject &filte
         dstName = filter["dstName"].toString();
     if (filter.contains("expressman"))
         expressman = filter["expressman"].toString();
+    Time sendingFrom(-1, -1, -1), sendingTo(-1, -1, -1);
+    for (const QString &key : {QString("from"), QString("to")})
+    {
+        if (!filter.contains(key))
+            continue;
+        QJsonObject bound = filter[key].toObject();
+        if (!bound.contains("year"))
+            return key + "缺少year键";
+        Time &time = (key == "from") ? sendingFrom : sendingTo;
+        time.year = bound["year"].toInt();
+        if (bound.contains("month"))
+            time.month = bound["month"].toInt();
+        if (bound.contains("day"))
+            time.day = bound["day"].toInt();
+    }
+
+    ItemPage page;
+    if (filter.contains("limit"))
+    {
+        page.limit = filter["limit"].toInt();
+        if (page.limit < 1 || page.limit > MAX_ITEM_PAGE_SIZE)
+            return "limit应该在1~" + QString::number(MAX_ITEM_PAGE_SIZE) + "之间";
+    }
+    if (filter.contains("orderBy"))
+    {
+        if (filter["orderBy"].toString() == "sendingTime")
+            page.orderBy = ORDER_BY_SENDING_TIME;
+        else if (filter["orderBy"].toString() != "id")
+            return "orderBy键的值有误";
+    }
+    if (filter.contains("cursor"))
+    {
+        //cursor为"排序方式:寄送日序号:单号"的base64编码
+        QList<QByteArray> parts = QByteArray::fromBase64(filter["cursor"].toString().toLatin1()).split(':');
+        bool okOrder = false, okKey = false, okId = false;
+        if (parts.size() == 3)
+        {
+            int orderBy = parts[0].toInt(&okOrder);
+            okOrder = okOrder && orderBy == page.orderBy;
+            page.afterKey = parts[1].toInt(&okKey);
+            page.afterId = parts[2].toInt(&okId);
+        }
+        if (!okOrder || !okKey || !okId || page.afterId < 0)
+            return "cursor有误";
+    }
+
+    QString descriptionContains = filter["descriptionContains"].toString();
+
+    //每查到一行直接写成JSON，只记下最后一行的排序键用于生成下一页的游标
+    int lastDay = -1, lastId = -1;
+    auto sink = [&ret, &lastDay, &lastId](const ItemRow &item) {
+        Time itemSendingTime = item.sendingTime(), itemReceivingTime = item.receivingTime();
+        QJsonObject itemJson;
+        itemJson.insert("id", item.id);
+        itemJson.insert("cost", item.cost);
+        itemJson.insert("type", item.type);
+        itemJson.insert("state", item.state);
+        itemJson.insert("sendingTime_Year", itemSendingTime.year);
+        itemJson.insert("sendingTime_Month", itemSendingTime.month);
+        itemJson.insert("sendingTime_Day", itemSendingTime.day);
+        itemJson.insert("receivingTime_Year", itemReceivingTime.year);
+        itemJson.insert("receivingTime_Month", itemReceivingTime.month);
+        itemJson.insert("receivingTime_Day", itemReceivingTime.day);
+        itemJson.insert("srcName", item.srcName);
+        itemJson.insert("dstName", item.dstName);
+        itemJson.insert("expressman", item.expressman);
+        itemJson.insert("description", item.description);
+        ret.append(itemJson);
+        lastDay = item.sendingDay;
+        lastId = item.id;
+    };
 
     switch (filter["type"].toInt())
     {
     case 0:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, expressman);
+        cnt = itemManage->queryByFilter(sink, id, state, sendingTime, receivingTime, srcName, dstName, expressman, sendingFrom, sendingTo, page, descriptionContains);
         break;
     case 1:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, username, dstName, expressman);
+        cnt = itemManage->queryByFilter(sink, id, state, sendingTime, receivingTime, username, dstName, expressman, sendingFrom, sendingTo, page, descriptionContains);
         break;
     case 2:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, username, expressman);
+        cnt = itemManage->queryByFilter(sink, id, state, sendingTime, receivingTime, srcName, username, expressman, sendingFrom, sendingTo, page, descriptionContains);
         break;
     case 3:
-        cnt = itemManage->queryByFilter(result, id, state, sendingTime, receivingTime, srcName, dstName, username);
+        cnt = itemManage->queryByFilter(sink, id, state, sendingTime, receivingTime, srcName, dstName, username, sendingFrom, sendingTo, page, descriptionContains);
         break;
     default:
         return "type键的值有误";
         break;
     }
 
-    for (const QSharedPointer<Item> &item : result)
+    if (page.limit != -1 && cnt == page.limit)
     {
-        QJsonObject itemJson;
-        itemJson.insert("id", item->getId());
-        itemJson.insert("cost", item->getCost());
-        itemJson.insert("type", item->getType());
-        itemJson.insert("state", item->getState());
-        itemJson.insert("sendingTime_Year", item->getSendingTime().year);
-        itemJson.insert("sendingTime_Month", item->getSendingTime().month);
-        itemJson.insert("sendingTime_Day", item->getSendingTime().day);
-        itemJson.insert("receivingTime_Year", item->getReceivingTime().year);
-        itemJson.insert("receivingTime_Month", item->getReceivingTime().month);
-        itemJson.insert("receivingTime_Day", item->getReceivingTime().day);
-        itemJson.insert("srcName", item->getSrcName());
-        itemJson.insert("dstName", item->getDstName());
-        itemJson.insert("expressman", item->getExpressman());
-        itemJson.insert("description", item->getDescription());
-        ret.append(itemJson);
+        QByteArray next = QByteArray::number(page.orderBy) + ":" + QByteArray::number(lastDay) + ":" + QByteArray::number(lastId);
+        cursor = QString::fromLatin1(next.toBase64());
     }
     return {};
 }
@@ -168,10 +364,13 @@ QString UserManage::registerUser(const QJsonObject &info) const
         return "用户名长度应该在1~10之间";
     if (db->queryUserByName(info["username"].toString()))
         return "该用户名已被注册";
+    if (db->hasLedger(info["username"].toString()))
+        return "该用户名已被使用过";
 
     QSharedPointer<User> user = QSharedPointer<Customer>::create(info["username"].toString(), info["password"].toString(), 0, info["name"].toString(), info["phonenumber"].toString(), info["address"].toString());
 
-    user->insertInfo2DB(db);
+    if (!user->insertInfo2DB(db))
+        return "注册失败";
 
     qDebug() << info["username"].toString() << " 注册成功";
     return {};
@@ -186,6 +385,8 @@ QString UserManage::registerExpressman(const QJsonObject &token, const QJsonObje
         return "用户名长度应该在1~10之间";
     if (db->queryUserByName(info["username"].toString()))
         return "该用户名已被注册";
+    if (db->hasLedger(info["username"].toString()))
+        return "该用户名已被使用过";
 
     QSharedPointer<User> user;
     switch (info["type"].toInt())
@@ -203,7 +404,13 @@ QString UserManage::registerExpressman(const QJsonObject &token, const QJsonObje
         break;
     }
 
-    user->insertInfo2DB(db);
+    if (!user->insertInfo2DB(db))
+        return "注册失败";
+    if (user->getUserType() == EXPRESSMAN)
+    {
+        dispatcher->expressmanAdded(user->getUsername());
+        dispatchQueued();
+    }
 
     qDebug() << info["username"].toString() << " 注册成功";
     return {};
@@ -222,10 +429,80 @@ QString UserManage::deleteExpressman(const QJsonObject &token, const QString &ex
     if (user->getUserType() != EXPRESSMAN)
         return "该用户不是快递员，无法删除";
 
-    if (db->deleteUser(expressman))
-        return "";
-    else
+    //他名下未揽收的快递先退回待分配，与删除在同一个请求保存点中，任何一步失败都整体撤销
+    QVector<ItemRow> items;
+    itemManage->queryByFilter([&items](const ItemRow &row) { items.append(row); }, -1, PENDING_COLLECTING, Time(-1, -1, -1), Time(-1, -1, -1), "", "", expressman);
+    if (!items.isEmpty())
+    {
+        ItemPatch patch;
+        patch.expressman = UNASSIGNED_EXPRESSMAN;
+        if (!itemManage->modifyBatch(items, patch))
+        {
+            db->abortRequest();
+            return "删除失败";
+        }
+    }
+
+    if (!db->deleteUser(expressman, Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay())))
+    {
+        db->abortRequest(); //退回待分配的快递也一起撤销，不重新派单
+        qDebug() << "删除快递员" << expressman << "失败";
         return "删除失败";
+    }
+    dispatcher->expressmanRemoved(expressman);
+    dispatcher->rebuild();
+    dispatchQueued();
+    qDebug() << "删除快递员" << expressman << "成功，" << items.size() << "个未揽收的快递重新派单";
+    return {};
+}
+
+UserManage::UserManage(Database *_db, ItemManage *_itemManage, Statistics *_stats, Dispatcher *_dispatcher) : db(_db), itemManage(_itemManage), stats(_stats), dispatcher(_dispatcher), seenRollbackCount(_db->getRollbackCount())
+{
+    QSettings settings(SETTINGS_FILE_NAME, QSettings::IniFormat);
+    dataDir = settings.value("server/dataDir", DATA_DIR_NAME).toString();
+}
+
+bool UserManage::resolveDataFile(const QString &fileName, QString &path) const
+{
+    QDir dir(dataDir);
+    QString root = dir.canonicalPath();
+    if (root.isEmpty() || fileName.isEmpty())
+        return false;
+
+    //所在目录和文件本身(已存在时)都按真实路径比较，..和符号链接都不能跳出数据目录
+    QFileInfo info(dir.absoluteFilePath(fileName));
+    QString parent = QDir(info.absolutePath()).canonicalPath();
+    if (parent.isEmpty() || (parent != root && !parent.startsWith(root + "/")))
+        return false;
+    path = parent + "/" + info.fileName();
+    if (info.exists())
+    {
+        QString real = QFileInfo(path).canonicalFilePath();
+        if (!real.startsWith(root + "/"))
+            return false;
+        path = real;
+    }
+    return true;
+}
+
+void UserManage::checkRollback()
+{
+    if (seenRollbackCount == db->getRollbackCount())
+        return;
+    QWriteLocker locker(&userMapLock);
+    for (auto i = userMap.begin(); i != userMap.end();)
+    {
+        QSharedPointer<User> user = db->queryUserByName(i.key());
+        if (user)
+        {
+            i.value() = user;
+            i++;
+        }
+        else
+            i = userMap.erase(i);
+    }
+    seenRollbackCount = db->getRollbackCount();
+    qDebug() << "数据库回滚过，重新读取" << userMap.size() << "个已登录用户的信息";
 }
 
 QString UserManage::login(const QString &username, const QString &password, QJsonObject &token)
@@ -233,7 +510,8 @@ QString UserManage::login(const QString &username, const QString &password, QJso
     QSharedPointer<User> user = db->queryUserByName(username);
     if (user && user->getPassword() == password)
     {
-        userMap[username] = user;
+        QWriteLocker locker(&userMapLock);
+        userMap[NameTable::intern(username)] = user;
         token.insert("iss", "Haolin Yang");
         token.insert("username", username);
         return {};
@@ -248,6 +526,7 @@ QString UserManage::logout(const QJsonObject &token)
     if (username.isEmpty())
         return "验证失败";
     qDebug() << "用户 " << username << " 登出";
+    QWriteLocker locker(&userMapLock);
     userMap.remove(username);
     return {};
 }
@@ -285,12 +564,7 @@ QString UserManage::queryAllUserInfo(const QJsonObject &token, QJsonArray &ret)
     if (userMap[username]->getUserType() != ADMINISTRATOR)
         return "非管理员不能查看所有用户信息";
 
-    QList<QSharedPointer<User>> result;
-
-    db->queryAllUser(result);
-
-    for (const QSharedPointer<User> &user : result)
-    {
+    db->queryAllUser([&ret](const QSharedPointer<User> &user) {
         QJsonObject itemJson;
         itemJson.insert("username", user->getUsername());
         itemJson.insert("type", user->getUserType());
@@ -299,7 +573,7 @@ QString UserManage::queryAllUserInfo(const QJsonObject &token, QJsonArray &ret)
         itemJson.insert("phonenumber", user->getPhoneNumber());
         itemJson.insert("address", user->getAddress());
         ret.append(itemJson);
-    }
+    });
     return {};
 }
 
@@ -321,28 +595,26 @@ QString UserManage::sendItem(const QJsonObject &token, const QJsonObject &info,
     if (user->getUserType() != CUSTOMER)
         return "你只能给用户寄出快递";
 
-    switch (info["type"].toInt())
-    {
-    case FRAGILE:
-        retCost = info["amount"].toInt() * FRAGILE_ITEM_PRICE;
-        break;
-    case BOOK:
-        retCost = info["amount"].toInt() * BOOK_PRICE;
-        break;
-    case NORMAL:
-        retCost = info["amount"].toInt() * NORMAL_ITEM_PRICE;
-        break;
-    default:
+    int price = itemPrice(info["type"].toInt());
+    if (!price)
         return "快递类型有误";
-    }
+    retCost = info["amount"].toInt() * price;
 
     QString ret = transferBalance(token, retCost, "admin");
     if (!ret.isEmpty())
         return ret;
 
     Time sendingTime(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay());
-    int id = itemManage->insertItem(retCost, PENDING_COLLECTING, info["type"].toInt(), sendingTime, Time(-1, -1, -1), username, info["dstName"].toString(), "未分配", info["description"].toString());
-    qDebug() << "添加快递单号为" << id;
+    QString expressman = dispatcher->pick(); //不自动派单或没有快递员时为"未分配"
+    int id = itemManage->insertItem(retCost, PENDING_COLLECTING, info["type"].toInt(), sendingTime, Time(-1, -1, -1), username, info["dstName"].toString(), expressman, info["description"].toString());
+    if (id == -1)
+    {
+        db->abortRequest(); //连同运费一起撤销
+        return "添加快递失败";
+    }
+    qDebug() << "添加快递单号为" << id << "，快递员为" << expressman;
+    if (expressman != UNASSIGNED_EXPRESSMAN && dispatcher->queuedCount())
+        dispatchQueued();
     return {};
 }
 
@@ -366,10 +638,12 @@ QString UserManage::deliveryItem(const QJsonObject &token, const int id) const
     if (!ret.isEmpty())
         return ret;
 
-    if (itemManage->modifyState(id, PENDING_REVEICING))
+    ItemPatch patch;
+    patch.state = PENDING_REVEICING;
+    if (itemManage->modify(id, patch))
         return {};
-    else
-        return "修改失败";
+    db->abortRequest(); //连同佣金一起撤销
+    return "修改失败";
 }
 
 QString UserManage::receiveItem(const QJsonObject &token, const int id) const
@@ -390,7 +664,10 @@ QString UserManage::receiveItem(const QJsonObject &token, const int id) const
     if (result->getState() == RECEIVED)
         return "该快递已签收";
 
-    if (itemManage->modifyState(id, RECEIVED) && itemManage->modifyReceivingTime(id, Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay())))
+    ItemPatch patch;
+    patch.state = RECEIVED;
+    patch.receivingTime = Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay());
+    if (itemManage->modify(id, patch))
         return {};
     else
         return "接收失败";
@@ -410,7 +687,7 @@ QString UserManage::assignExpressman(const QJsonObject &token, const QJsonObject
     QSharedPointer<Item> result;
     if (!itemManage->queryById(result, info["itemId"].toInt()))
         return "不存在运单号为该ID的物品";
-    if (result->getExpressman() != "未分配")
+    if (result->getExpressman() != UNASSIGNED_EXPRESSMAN)
         return "该快递已分配快递员";
 
     QSharedPointer<User> user = db->queryUserByName(info["expressman"].toString());
@@ -419,7 +696,9 @@ QString UserManage::assignExpressman(const QJsonObject &token, const QJsonObject
     if (user->getUserType() != EXPRESSMAN)
         return "该用户不是快递员";
 
-    if (itemManage->modifyExpressman(info["itemId"].toInt(), info["expressman"].toString()))
+    ItemPatch patch;
+    patch.expressman = info["expressman"].toString();
+    if (itemManage->modify(info["itemId"].toInt(), patch))
         return {};
     else
         return "修改失败";
@@ -442,3 +721,146 @@ QString UserManage::deleteItem(const QJsonObject &token, const int id) const
     else
         return "删除快递失败";
 }
+
+QString UserManage::loadItemBatch(const QJsonArray &itemIds, QVector<ItemRow> &items) const
+{
+    if (itemIds.isEmpty() || itemIds.size() > MAX_BULK_ITEMS)
+        return "itemIds中的单号数应该在1~" + QString::number(MAX_BULK_ITEMS) + "之间";
+
+    QVector<int> ids;
+    ids.reserve(itemIds.size());
+    for (const QJsonValue &value : itemIds)
+    {
+        if (!value.isDouble())
+            return "itemIds中的单号有误";
+        ids.append(value.toInt());
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    items.reserve(ids.size());
+    if (itemManage->queryByIds(ids, items) != ids.size())
+    {
+        QSet<int> found;
+        for (const ItemRow &item : items)
+            found.insert(item.id);
+        for (int id : ids)
+            if (!found.contains(id))
+                return "不存在运单号为" + QString::number(id) + "的物品";
+    }
+    return {};
+}
+
+QString UserManage::assignItems(const QJsonObject &token, const QJsonArray &itemIds, const QString &expressman) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != ADMINISTRATOR)
+        return "非管理员不能为快递指定快递员";
+
+    QVector<ItemRow> items;
+    QString ret = loadItemBatch(itemIds, items);
+    if (!ret.isEmpty())
+        return ret;
+    for (const ItemRow &item : items)
+        if (item.expressman != UNASSIGNED_EXPRESSMAN)
+            return "运单号为" + QString::number(item.id) + "的快递已分配快递员";
+
+    QSharedPointer<User> user = db->queryUserByName(expressman);
+    if (!user)
+        return "不存在该快递员";
+    if (user->getUserType() != EXPRESSMAN)
+        return "该用户不是快递员";
+
+    ItemPatch patch;
+    patch.expressman = expressman;
+    if (itemManage->modifyBatch(items, patch))
+        return {};
+    db->abortRequest();
+    return "修改失败";
+}
+
+QString UserManage::deliveryItems(const QJsonObject &token, const QJsonArray &itemIds) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != EXPRESSMAN)
+        return "非快递员不能运送快递";
+
+    QVector<ItemRow> items;
+    QString ret = loadItemBatch(itemIds, items);
+    if (!ret.isEmpty())
+        return ret;
+    int commission = 0;
+    for (const ItemRow &item : items)
+    {
+        if (item.state != PENDING_COLLECTING)
+            return "运单号为" + QString::number(item.id) + "的快递已发出";
+        if (item.expressman != username)
+            return "运单号为" + QString::number(item.id) + "的快递不是你所属的快递";
+        commission += item.cost / 2;
+    }
+
+    ret = transferBalance(token, -commission, "admin");
+    if (!ret.isEmpty())
+        return ret;
+
+    //佣金和批量修改在同一个请求保存点中，修改失败时连同佣金一起撤销
+    ItemPatch patch;
+    patch.state = PENDING_REVEICING;
+    if (itemManage->modifyBatch(items, patch))
+        return {};
+    db->abortRequest();
+    return "修改失败";
+}
+
+QString UserManage::receiveItems(const QJsonObject &token, const QJsonArray &itemIds) const
+{
+    QString username = verify(token);
+    if (username.isEmpty())
+        return "验证失败";
+    if (userMap[username]->getUserType() != CUSTOMER)
+        return "非用户不能接收快递";
+
+    QVector<ItemRow> items;
+    QString ret = loadItemBatch(itemIds, items);
+    if (!ret.isEmpty())
+        return ret;
+    for (const ItemRow &item : items)
+    {
+        if (item.dstName != username)
+            return "运单号为" + QString::number(item.id) + "的快递不是您的快递";
+        if (item.state == PENDING_COLLECTING)
+            return "运单号为" + QString::number(item.id) + "的快递还未到达";
+        if (item.state == RECEIVED)
+            return "运单号为" + QString::number(item.id) + "的快递已签收";
+    }
+
+    ItemPatch patch;
+    patch.state = RECEIVED;
+    patch.receivingTime = Time(Time::getCurYear(), Time::getCurMonth(), Time::getCurDay());
+    if (itemManage->modifyBatch(items, patch))
+        return {};
+    db->abortRequest();
+    return "接收失败";
+}
+
+void UserManage::dispatchQueued() const
+{
+    QHash<QString, QVector<int>> plan = dispatcher->planQueued(MAX_BULK_ITEMS);
+    for (auto i = plan.constBegin(); i != plan.constEnd(); i++)
+    {
+        QVector<ItemRow> items;
+        itemManage->queryByIds(i.value(), items);
+        if (items.isEmpty())
+            continue;
+        ItemPatch patch;
+        patch.expressman = i.key();
+        if (itemManage->modifyBatch(items, patch))
+            qDebug() << "派单:把" << items.size() << "个待分配的物品派给" << i.key();
+        else
+            qCritical() << "派单:把" << items.size() << "个待分配的物品派给" << i.key() << "失败";
+    }
+}